@@ -0,0 +1,24 @@
+#!/bin/bash
+# Compares the synchronous and asynchronous server, and the asynchronous
+# server on io_uring, under the same load.
+# Run from the build directory: ../bench/bench-server.sh [clients...]
+CLIENTS=${@:-16 64 256 1024}
+
+run_mode() {
+    rm -rf /tmp/hearty
+    ./hearty-store-server $1 > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+
+    for n in $CLIENTS; do
+        echo -n "[$2] "
+        ./hearty-store-bench-server --clients $n --requests 20 --size 4096
+    done
+
+    kill $SERVER_PID
+    wait $SERVER_PID 2> /dev/null || true
+}
+
+run_mode "" sync
+run_mode "--async" async
+run_mode "--async --io-uring" io_uring
@@ -0,0 +1,103 @@
+/**
+ * @file hearty-store-bench-hash.cpp
+ * @author Nathadon Samairat
+ * @brief Measures the checksum kernels a Get can verify blocks with: CRC32C
+ *        with the crc32 instruction, the table driven CRC32C and the MD5 hex
+ *        digest Puts used to log. Each kernel hashes the same block over and
+ *        over and reports its throughput and the time it adds to reading a
+ *        block from a disk of the given bandwidth.
+ * @version 0.1
+ * @date 2024-12-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include "hearty-store-server.hpp"
+#include "hearty-store-crc32c.hpp"
+
+struct BenchOptions {
+    size_t block_size = BLOCK_SIZE;     // Bytes hashed per call
+    size_t iterations = 1000;           // Calls per kernel
+    double read_bandwidth = 2000;       // Disk read bandwidth in MB/s the cost is compared to
+};
+
+// Helper function to hash with MD5 and format the digest as hex, like Puts used to
+static std::string md5Hex(const char* data, size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data, size, digest, &length, EVP_md5(), nullptr);
+
+    std::stringstream ss;
+    for (unsigned int i = 0; i < length; i++) {
+        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(digest[i]);
+    }
+    return ss.str();
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--block-size" && i + 1 < argc) {
+            options.block_size = std::stoul(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            options.iterations = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--read-bandwidth" && i + 1 < argc) {
+            options.read_bandwidth = std::stod(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--block-size <bytes>] [--iterations <n>] [--read-bandwidth <MB/s>]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::string block(options.block_size, '\0');
+    std::mt19937_64 random(42);
+    for (char& byte : block) {
+        byte = static_cast<char>(random());
+    }
+
+    std::vector<std::pair<std::string, std::function<uint32_t(const char*, size_t)>>> kernels = {
+        {"crc32c", [](const char* data, size_t size) { return crc32c(0, data, size); }},
+        {"crc32c-table", [](const char* data, size_t size) { return crc32cSoftware(0, data, size); }},
+        {"md5-hex", [](const char* data, size_t size) {
+            // Fold the whole digest in, so none of its formatting is optimized away
+            uint32_t folded = 0;
+            for (char digit : md5Hex(data, size)) {
+                folded = folded * 31 + static_cast<unsigned char>(digit);
+            }
+            return folded;
+        }},
+    };
+
+    // Time to read one block from disk, what a Get pays anyway
+    double read_us = options.block_size / (options.read_bandwidth * 1e6) * 1e6;
+    for (const auto& [name, kernel] : kernels) {
+        uint32_t sink = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < options.iterations; n++) {
+            sink ^= kernel(block.data(), block.size());
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        double block_us = elapsed / options.iterations * 1e6;
+        std::cout << "kernel=" << name
+                  << " block=" << options.block_size << " bytes"
+                  << " throughput=" << options.block_size * options.iterations / elapsed / 1e9 << " GB/s"
+                  << " per_block=" << block_us << " us"
+                  << " read_overhead=" << 100.0 * block_us / read_us << "%"
+                  << " (sink " << sink << ")" << std::endl;
+    }
+
+    return 0;
+}
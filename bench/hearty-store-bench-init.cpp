@@ -0,0 +1,93 @@
+/**
+ * @file hearty-store-bench-init.cpp
+ * @author Nathadon Samairat
+ * @brief Measures store creation. Calls initialize() directly for a number of
+ *        fresh stores and reports the Init latency, the disk space taken by
+ *        data.bin and the peak resident set size of the process. Run it with
+ *        and without --preallocate to compare sparse and reserved stores.
+ * @version 0.1
+ * @date 2024-12-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "hearty-store-server.hpp"
+
+struct BenchOptions {
+    int first_store = 900;          // Stores first_store .. first_store + stores - 1 are used
+    size_t stores = 10;             // Number of stores to create
+    bool preallocate = false;       // Reserve the data file instead of leaving it sparse
+};
+
+// Helper function to return the bytes actually allocated on disk for a file
+static long long allocatedBytes(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return -1;
+    }
+    return static_cast<long long>(st.st_blocks) * 512;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--preallocate") {
+            options.preallocate = true;
+        } else if (arg == "--stores" && i + 1 < argc) {
+            options.stores = std::stoul(argv[++i]);
+        } else if (arg == "--first-store" && i + 1 < argc) {
+            options.first_store = std::stoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--stores <n>] [--first-store <id>] [--preallocate]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<double> latencies;
+    long long disk_bytes = 0;
+    for (size_t n = 0; n < options.stores; n++) {
+        int store_id = options.first_store + static_cast<int>(n);
+        if (utils::storeExists(store_id)) {
+            destroy_store(store_id);
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        bool ok = initialize(store_id, options.preallocate);
+        auto end = std::chrono::steady_clock::now();
+        if (!ok) {
+            std::cerr << "Failed to initialize store " << store_id << std::endl;
+            return 1;
+        }
+
+        latencies.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+        disk_bytes += allocatedBytes(utils::getDataPath(store_id));
+        destroy_store(store_id);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cout << "mode=" << (options.preallocate ? "preallocate" : "sparse")
+              << " stores=" << latencies.size()
+              << " avg=" << total / latencies.size() << " ms"
+              << " max=" << latencies.back() << " ms"
+              << " data_on_disk=" << disk_bytes / latencies.size() / 1024 << " KiB/store"
+              << " peak_rss=" << usage.ru_maxrss << " KiB" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file hearty-store-bench-server.cpp
+ * @author Nathadon Samairat
+ * @brief Load generator for the hearty store server. Opens many concurrent
+ *        clients issuing a Get/Put mix against one store and reports the
+ *        throughput and latency percentiles. Run it once against the
+ *        synchronous server and once against `hearty-store-server --async`
+ *        (see bench-server.sh) to compare the two. With --batch every
+ *        request carries that many objects through BatchGet/BatchPut.
+ * @version 0.1
+ * @date 2024-12-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include <proto/hearty-store.grpc.pb.h>
+#include <proto/hearty-store.pb.h>
+
+struct BenchOptions {
+    std::string address = "localhost:2546";
+    std::string store_name = "90";
+    size_t clients = 64;            // Concurrent client threads
+    size_t requests = 100;          // Requests issued by each client
+    size_t object_size = 4096;      // Bytes per object
+    double read_ratio = 0.9;        // Fraction of requests that are Get
+    size_t batch = 1;               // Objects per request, above 1 uses the batch RPCs
+    std::string engine;             // Storage engine of the store if it is created, "block" or "log"
+};
+
+// Helper function to read a whole Get stream, returns false on failure
+bool getObject(ProcessingService::Stub* stub, const BenchOptions& options,
+               const std::string& file_id) {
+    getRequest request;
+    getResponse response;
+    grpc::ClientContext context;
+    request.set_store_name(options.store_name);
+    request.set_file_identifier(file_id);
+
+    bool success = true;
+    std::unique_ptr<grpc::ClientReader<getResponse>> reader = stub->Get(&context, request);
+    while (reader->Read(&response)) {
+        success = success && response.success();
+    }
+    return reader->Finish().ok() && success;
+}
+
+// Helper function to store an object, returns its id or an empty string
+std::string putObject(ProcessingService::Stub* stub, const BenchOptions& options,
+                      const std::string& file_path, const std::string& content) {
+    putRequest request;
+    putResponse response;
+    grpc::ClientContext context;
+    request.set_store_name(options.store_name);
+    request.set_file_path(file_path);
+    request.set_file_content(content);
+
+    grpc::Status status = stub->Put(&context, request, &response);
+    if (!status.ok() || !response.success()) {
+        return "";
+    }
+    return response.file_id();
+}
+
+// Helper function to read many objects in one BatchGet, returns false on failure
+bool getBatch(ProcessingService::Stub* stub, const BenchOptions& options,
+              const std::vector<std::string>& file_ids) {
+    batchGetRequest request;
+    batchGetResponse response;
+    grpc::ClientContext context;
+    request.set_store_name(options.store_name);
+    for (const std::string& file_id : file_ids) {
+        request.add_file_identifiers(file_id);
+    }
+
+    grpc::Status status = stub->BatchGet(&context, request, &response);
+    if (!status.ok() || !response.success()) {
+        return false;
+    }
+    for (const batchGetObject& object : response.objects()) {
+        if (!object.success()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Helper function to store many objects in one BatchPut, returns their ids or an empty list
+std::vector<std::string> putBatch(ProcessingService::Stub* stub, const BenchOptions& options,
+                                  const std::string& path_prefix, const std::string& content) {
+    batchPutRequest request;
+    batchPutResponse response;
+    grpc::ClientContext context;
+    request.set_store_name(options.store_name);
+    for (size_t i = 0; i < options.batch; i++) {
+        batchPutObject* object = request.add_objects();
+        object->set_file_path(path_prefix + "-" + std::to_string(i));
+        object->set_file_content(content);
+    }
+
+    grpc::Status status = stub->BatchPut(&context, request, &response);
+    if (!status.ok() || !response.success()) {
+        return {};
+    }
+    return std::vector<std::string>(response.file_ids().begin(), response.file_ids().end());
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--address") {
+            options.address = argv[i + 1];
+        } else if (arg == "--store") {
+            options.store_name = argv[i + 1];
+        } else if (arg == "--clients") {
+            options.clients = std::stoul(argv[i + 1]);
+        } else if (arg == "--requests") {
+            options.requests = std::stoul(argv[i + 1]);
+        } else if (arg == "--size") {
+            options.object_size = std::stoul(argv[i + 1]);
+        } else if (arg == "--read-ratio") {
+            options.read_ratio = std::stod(argv[i + 1]);
+        } else if (arg == "--batch") {
+            options.batch = std::max<size_t>(1, std::stoul(argv[i + 1]));
+        } else if (arg == "--engine") {
+            options.engine = argv[i + 1];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--address <host:port>] [--store <name>]"
+                      << " [--clients <n>] [--requests <n>] [--size <bytes>]"
+                      << " [--read-ratio <0..1>] [--batch <objects>] [--engine <block|log>]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Batch responses can be larger than gRPC's 4 MB default
+    grpc::ChannelArguments channel_args;
+    channel_args.SetMaxReceiveMessageSize(-1);
+    auto channel = grpc::CreateCustomChannel(options.address, grpc::InsecureChannelCredentials(),
+                                             channel_args);
+    std::unique_ptr<ProcessingService::Stub> stub = ProcessingService::NewStub(channel);
+
+    // Create the store (it may already exist) and seed the object every Get reads
+    {
+        initRequest request;
+        initResponse response;
+        grpc::ClientContext context;
+        request.set_store_name(options.store_name);
+        request.set_engine(options.engine);
+        stub->Init(&context, request, &response);
+    }
+    std::string content(options.object_size, 'x');
+    std::vector<std::string> file_ids = options.batch > 1
+        ? putBatch(stub.get(), options, "bench-seed", content)
+        : std::vector<std::string>{putObject(stub.get(), options, "bench-seed", content)};
+    if (file_ids.empty() || file_ids.front().empty()) {
+        std::cerr << "Failed to seed store " << options.store_name << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<double>> latencies(options.clients);
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> clients;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < options.clients; c++) {
+        clients.emplace_back([&, c] {
+            std::mt19937 gen(c);
+            std::uniform_real_distribution<> dis(0.0, 1.0);
+            std::string file_path = "bench-" + std::to_string(c);
+
+            for (size_t r = 0; r < options.requests; r++) {
+                auto begin = std::chrono::steady_clock::now();
+                bool read = dis(gen) < options.read_ratio;
+                bool ok;
+                if (options.batch > 1) {
+                    ok = read ? getBatch(stub.get(), options, file_ids)
+                              : !putBatch(stub.get(), options, file_path, content).empty();
+                } else {
+                    ok = read ? getObject(stub.get(), options, file_ids.front())
+                              : !putObject(stub.get(), options, file_path, content).empty();
+                }
+                auto end = std::chrono::steady_clock::now();
+
+                if (!ok) {
+                    failures++;
+                }
+                latencies[c].push_back(
+                    std::chrono::duration<double, std::milli>(end - begin).count());
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const auto& client_latencies : latencies) {
+        all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) {
+        return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+    };
+
+    std::cout << "clients=" << options.clients
+              << " requests=" << all.size()
+              << " failed=" << failures.load()
+              << " throughput=" << all.size() / elapsed << " req/s"
+              << " objects=" << all.size() * options.batch / elapsed << " obj/s"
+              << " p50=" << percentile(0.50) << " ms"
+              << " p99=" << percentile(0.99) << " ms" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file hearty-store-block-bitmap.hpp
+ * @author Nathadon Samairat
+ * @brief Free space bitmap of a store, one bit per block (1 = in use).
+ *        Allocation scans a 64-bit word at a time and picks the first zero
+ *        bit with ctz, starting from where the last allocation left off.
+ *        Multi-block objects take runs of contiguous free blocks instead.
+ * @version 0.1
+ * @date 2024-12-09
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_BLOCK_BITMAP_HPP
+#define HEARTY_STORE_BLOCK_BITMAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class BlockBitmap {
+private:
+    std::vector<uint64_t> words;
+    size_t num_blocks = 0;
+    size_t used = 0;            // Number of set bits, kept in step with set/clear
+    size_t cursor = 0;          // Word to start the next search from
+
+public:
+    BlockBitmap() = default;
+    explicit BlockBitmap(size_t num_blocks) { resize(num_blocks); }
+
+    // Resets the bitmap to num_blocks free blocks
+    void resize(size_t blocks) {
+        num_blocks = blocks;
+        words.assign((blocks + 63) / 64, 0);
+        // Bits past the last block are permanently in use so they are never handed out
+        if (blocks % 64 != 0) {
+            words.back() = ~0ULL << (blocks % 64);
+        }
+        used = 0;
+        cursor = 0;
+    }
+
+    // Extends the bitmap to num_blocks blocks, keeping the state of the
+    // existing ones; the new blocks are free
+    void grow(size_t blocks) {
+        if (blocks <= num_blocks) {
+            return;
+        }
+        if (num_blocks % 64 != 0) {
+            words.back() &= ~(~0ULL << (num_blocks % 64));
+        }
+        words.resize((blocks + 63) / 64, 0);
+        if (blocks % 64 != 0) {
+            words.back() |= ~0ULL << (blocks % 64);
+        }
+        num_blocks = blocks;
+    }
+
+    bool test(size_t block) const {
+        return (words[block / 64] >> (block % 64)) & 1;
+    }
+
+    void set(size_t block) {
+        if (!test(block)) {
+            words[block / 64] |= 1ULL << (block % 64);
+            used++;
+        }
+    }
+
+    void clear(size_t block) {
+        if (test(block)) {
+            words[block / 64] &= ~(1ULL << (block % 64));
+            used--;
+            // Let the next search find the freed block early
+            if (block / 64 < cursor) {
+                cursor = block / 64;
+            }
+        }
+    }
+
+    /**
+     * @brief Finds a free block and marks it used.
+     *
+     * @return The block index, or -1 if every block is in use.
+     */
+    long allocate() {
+        size_t num_words = words.size();
+        for (size_t n = 0; n < num_words; n++) {
+            size_t w = (cursor + n) % num_words;
+            uint64_t free_bits = ~words[w];
+            if (free_bits != 0) {
+                size_t block = w * 64 + __builtin_ctzll(free_bits);
+                words[w] |= 1ULL << (block % 64);
+                used++;
+                cursor = w;
+                return block;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Finds a run of contiguous free blocks and marks it used. The
+     *        first run of `want` blocks at or after `hint` wins, then the
+     *        first one before it. If no run is long enough the longest free
+     *        run is returned and the caller asks again for the rest.
+     *
+     * @param want  - Number of blocks wanted, at least 1.
+     * @param hint  - Block to prefer the run to start from.
+     * @param got   - Set to the number of blocks in the returned run.
+     * @return The first block of the run, or -1 if every block is in use.
+     */
+    long allocateRun(size_t want, size_t hint, size_t& got) {
+        long fit_after = -1, fit_before = -1, longest = -1;
+        size_t longest_size = 0;
+
+        size_t block = 0;
+        while (block < num_blocks) {
+            // Skip fully used words in one step
+            if (block % 64 == 0 && words[block / 64] == ~0ULL) {
+                block += 64;
+                continue;
+            }
+            if (test(block)) {
+                block++;
+                continue;
+            }
+
+            // A run crossing the hint is split there so a fit can start at the hint
+            size_t start = block;
+            size_t limit = start < hint ? std::min(start + want, hint) : start + want;
+            while (block < num_blocks && block < limit && !test(block)) {
+                block++;
+            }
+            size_t size = block - start;
+            if (size == want) {
+                if (start >= hint) {
+                    fit_after = start;
+                    break;
+                }
+                if (fit_before == -1) {
+                    fit_before = start;
+                }
+            } else if (size > longest_size) {
+                longest = start;
+                longest_size = size;
+            }
+        }
+
+        long start = fit_after != -1 ? fit_after : fit_before;
+        got = want;
+        if (start == -1) {
+            start = longest;
+            got = longest_size;
+        }
+        if (start == -1) {
+            got = 0;
+            return -1;
+        }
+
+        for (size_t i = 0; i < got; i++) {
+            set(start + i);
+        }
+        return start;
+    }
+
+    // Number of blocks in use
+    size_t count() const { return used; }
+
+    size_t size() const { return num_blocks; }
+};
+
+#endif // HEARTY_STORE_BLOCK_BITMAP_HPP
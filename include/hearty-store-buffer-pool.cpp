@@ -0,0 +1,241 @@
+/**
+ * @file hearty-store-buffer-pool.cpp
+ * @author Nathadon Samairat
+ * @brief 2Q replacement of the server-side buffer pool.
+ * @version 0.1
+ * @date 2024-12-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <iomanip>
+#include <sstream>
+#include "hearty-store-buffer-pool.hpp"
+
+/**
+ * @brief Returns the process wide pool.
+ */
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+void BufferPool::setCapacity(size_t bytes) {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    capacity = bytes;
+    reclaim();
+}
+
+bool BufferPool::enabled() const {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    return capacity > 0;
+}
+
+// Returns a resident block and counts the hit, pool_lock must be held
+PoolBlock BufferPool::find(const PoolKey& key) {
+    auto it = resident.find(key);
+    if (it == resident.end()) {
+        return nullptr;
+    }
+
+    // A Get looks each block up once, so a second lookup is a real reuse and
+    // moves a block out of the FIFO
+    hits++;
+    std::list<Entry>::iterator entry = it->second;
+    if (entry->frequent) {
+        frequent.splice(frequent.begin(), frequent, entry);
+    } else {
+        recent_bytes -= entry->data->size();
+        frequent_bytes += entry->data->size();
+        entry->frequent = true;
+        frequent.splice(frequent.begin(), recent, entry);
+    }
+    return entry->data;
+}
+
+PoolBlock BufferPool::lookup(const PoolKey& key) {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    PoolBlock data = find(key);
+    if (!data) {
+        misses++;
+    }
+    return data;
+}
+
+/**
+ * @brief Returns a block, reading it on a miss. The first miss on a block
+ *        registers the read and does it without the pool lock; misses that
+ *        arrive meanwhile wait for it and get the same buffer, so a block
+ *        requested by many clients at once is read from disk once. Only the
+ *        waiters of that block are woken when it arrives. The buffer is
+ *        handed to them whether or not the pool has room to keep it, so a
+ *        block larger than the pool is still read once per burst of misses
+ *        but read again by the next one.
+ *
+ * @param key   - Store, object and block index.
+ * @param read  - Reads the block from disk, null on failure.
+ * @return The block, or null if the read failed.
+ */
+PoolBlock BufferPool::load(const PoolKey& key, const std::function<PoolBlock()>& read) {
+    std::shared_ptr<Load> pending;
+    {
+        std::unique_lock<std::mutex> guard(pool_lock);
+        PoolBlock data = find(key);
+        if (data) {
+            return data;
+        }
+
+        auto it = loading.find(key);
+        if (it != loading.end()) {
+            std::shared_ptr<Load> shared = it->second;
+            coalesced++;
+            shared->loaded_cv.wait(guard, [&shared] { return shared->done; });
+            return shared->data;
+        }
+        misses++;
+        pending = std::make_shared<Load>();
+        loading[key] = pending;
+    }
+
+    PoolBlock data = read();
+    {
+        std::lock_guard<std::mutex> guard(pool_lock);
+        loading.erase(key);
+        pending->data = data;
+        pending->done = true;
+        add(key, data);
+    }
+    pending->loaded_cv.notify_all();
+    return data;
+}
+
+/**
+ * @brief Caches a block. A block whose key is still remembered from an
+ *        earlier eviction has been read twice far apart and goes to the main
+ *        queue; any other block enters the FIFO.
+ *
+ * @param key   - Store, object and block index.
+ * @param data  - The bytes of the block.
+ */
+void BufferPool::insert(const PoolKey& key, PoolBlock data) {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    add(key, std::move(data));
+}
+
+/**
+ * @brief Decides whether a block that is only partly needed is read into the
+ *        pool whole. A block read before or being read now is; for any other
+ *        block the caller reads just the bytes it needs, and the key is
+ *        remembered, so the block is loaded once it is asked for again.
+ *
+ * @param key   - Store, object and block index.
+ * @param size  - Bytes of the whole block.
+ * @return true if the block should be loaded into the pool; false otherwise
+ */
+bool BufferPool::admit(const PoolKey& key, size_t size) {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    if (resident.count(key) || loading.count(key) || remembered.count(key)) {
+        return true;
+    }
+
+    misses++;
+    ghosts.push_front({key, size});
+    remembered[key] = ghosts.begin();
+    ghost_bytes += size;
+    reclaim();
+    return false;
+}
+
+// Caches a block, pool_lock must be held
+void BufferPool::add(const PoolKey& key, PoolBlock data) {
+    if (!data || data->size() > capacity || resident.count(key)) {
+        return;
+    }
+
+    bool was_remembered = false;
+    auto ghost = remembered.find(key);
+    if (ghost != remembered.end()) {
+        ghost_bytes -= ghost->second->size;
+        ghosts.erase(ghost->second);
+        remembered.erase(ghost);
+        was_remembered = true;
+    }
+
+    size_t size = data->size();
+    std::list<Entry>& queue = was_remembered ? frequent : recent;
+    queue.push_front({key, std::move(data), was_remembered});
+    resident[key] = queue.begin();
+    (was_remembered ? frequent_bytes : recent_bytes) += size;
+    reclaim();
+}
+
+// Drops a resident block without remembering it, pool_lock must be held
+void BufferPool::erase(std::unordered_map<PoolKey, std::list<Entry>::iterator, PoolKeyHash>::iterator it) {
+    std::list<Entry>::iterator entry = it->second;
+    if (entry->frequent) {
+        frequent_bytes -= entry->data->size();
+        frequent.erase(entry);
+    } else {
+        recent_bytes -= entry->data->size();
+        recent.erase(entry);
+    }
+    resident.erase(it);
+}
+
+// Evicts blocks until the pool fits its budget, pool_lock must be held
+void BufferPool::reclaim() {
+    size_t recent_limit = capacity * POOL_RECENT_SHARE;
+    while (recent_bytes + frequent_bytes > capacity) {
+        if (!recent.empty() && (recent_bytes > recent_limit || frequent.empty())) {
+            // The oldest block read once is only remembered by its key
+            Entry& victim = recent.back();
+            ghosts.push_front({victim.key, victim.data->size()});
+            remembered[victim.key] = ghosts.begin();
+            ghost_bytes += victim.data->size();
+            erase(resident.find(victim.key));
+        } else {
+            erase(resident.find(frequent.back().key));
+        }
+        evictions++;
+    }
+
+    size_t ghost_limit = capacity * POOL_GHOST_SHARE;
+    while (!ghosts.empty() && ghost_bytes > ghost_limit) {
+        ghost_bytes -= ghosts.back().size;
+        remembered.erase(ghosts.back().key);
+        ghosts.pop_back();
+    }
+}
+
+void BufferPool::eraseStore(int store_id) {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    for (auto it = resident.begin(); it != resident.end();) {
+        auto next = std::next(it);
+        if (it->first.store_id == store_id) {
+            erase(it);
+        }
+        it = next;
+    }
+    for (auto it = ghosts.begin(); it != ghosts.end();) {
+        if (it->key.store_id == store_id) {
+            ghost_bytes -= it->size;
+            remembered.erase(it->key);
+            it = ghosts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::string BufferPool::describe() const {
+    std::lock_guard<std::mutex> guard(pool_lock);
+    std::ostringstream output;
+    uint64_t lookups = hits + misses + coalesced;
+    output << std::fixed << std::setprecision(1) << "Buffer pool: "
+           << (recent_bytes + frequent_bytes) / (1024.0 * 1024.0) << "/" << capacity / (1024.0 * 1024.0)
+           << " MB (" << frequent_bytes / (1024.0 * 1024.0) << " MB hot), " << hits << " hits, "
+           << misses << " misses (" << (lookups ? 100.0 * hits / lookups : 0.0) << "% hit rate), "
+           << coalesced << " coalesced, " << evictions << " evictions";
+    return output.str();
+}
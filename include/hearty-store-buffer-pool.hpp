@@ -0,0 +1,132 @@
+/**
+ * @file hearty-store-buffer-pool.hpp
+ * @author Nathadon Samairat
+ * @brief Server-side pool of object blocks read from disk, shared by every
+ *        store, so a popular object is served from RAM. An object is cut
+ *        into POOL_BLOCK_SIZE pieces; each piece is cached on its own under
+ *        the object's id, which never names other content. Replacement is
+ *        2Q: a block read for the first time goes to a small FIFO and is
+ *        only remembered by its key once it leaves; a block read again, from
+ *        the FIFO or while it is remembered, goes to the LRU main queue.
+ *        A long read starting on a block not seen lately goes around the
+ *        pool, and a read of part of such a block copies only that part;
+ *        both just leave the key remembered. Concurrent misses on the same
+ *        block are coalesced: the first one reads it and the others wait
+ *        for its buffer.
+ * @version 0.1
+ * @date 2024-12-18
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_BUFFER_POOL_HPP
+#define HEARTY_STORE_BUFFER_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "hearty-store-server.hpp"
+
+const size_t POOL_BLOCK_SIZE = BLOCK_SIZE;          // Object bytes per pooled block
+const size_t DEFAULT_POOL_CAPACITY = 256 * 1024 * 1024;
+const double POOL_RECENT_SHARE = 0.25;              // Part of the budget for blocks read once
+const double POOL_GHOST_SHARE = 0.5;                // Bytes of evicted blocks remembered by key
+const size_t POOL_BYPASS_SIZE = 8 * POOL_BLOCK_SIZE; // Reads this long starting on a block not seen lately skip the pool
+
+struct PoolKey {
+    int store_id;
+    std::string object_id;
+    uint64_t block;         // Index of the block within the object
+
+    bool operator==(const PoolKey& other) const {
+        return store_id == other.store_id && block == other.block && object_id == other.object_id;
+    }
+};
+
+struct PoolKeyHash {
+    size_t operator()(const PoolKey& key) const {
+        size_t hash = std::hash<std::string>()(key.object_id);
+        hash ^= std::hash<uint64_t>()(key.block) + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+        return hash ^ (static_cast<size_t>(key.store_id) << 1);
+    }
+};
+
+using PoolBlock = std::shared_ptr<const std::string>;
+
+class BufferPool {
+private:
+    struct Entry {
+        PoolKey key;
+        PoolBlock data;
+        bool frequent;      // In the main queue rather than the FIFO
+    };
+    struct Ghost {
+        PoolKey key;
+        size_t size;
+    };
+    // A block being read after a miss, the misses waiting for it wait on its own condition
+    struct Load {
+        bool done = false;
+        PoolBlock data;     // Null if the read failed
+        std::condition_variable loaded_cv;
+    };
+
+    mutable std::mutex pool_lock;
+    std::list<Entry> recent;        // FIFO of blocks read once, newest first
+    std::list<Entry> frequent;      // LRU of blocks read again, most recent first
+    std::list<Ghost> ghosts;        // Keys of blocks evicted from the FIFO, newest first
+    std::unordered_map<PoolKey, std::list<Entry>::iterator, PoolKeyHash> resident;
+    std::unordered_map<PoolKey, std::list<Ghost>::iterator, PoolKeyHash> remembered;
+    // Reads in progress. They are not part of the cached bytes: a block is
+    // only here while it is read, and its waiters get the buffer even if the
+    // pool does not keep it. Their memory is not counted against capacity.
+    std::unordered_map<PoolKey, std::shared_ptr<Load>, PoolKeyHash> loading;
+    size_t capacity = DEFAULT_POOL_CAPACITY;
+    size_t recent_bytes = 0;
+    size_t frequent_bytes = 0;
+    size_t ghost_bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t coalesced = 0;     // Misses that waited for another read of the block
+
+    PoolBlock find(const PoolKey& key);
+    void add(const PoolKey& key, PoolBlock data);
+    void reclaim();
+    void erase(std::unordered_map<PoolKey, std::list<Entry>::iterator, PoolKeyHash>::iterator it);
+
+public:
+    static BufferPool& instance();
+
+    // Memory budget of the cached blocks, 0 turns the pool off
+    void setCapacity(size_t bytes);
+    bool enabled() const;
+
+    // Returns a cached block, or null after counting a miss
+    PoolBlock lookup(const PoolKey& key);
+
+    // Caches a block read after a miss
+    void insert(const PoolKey& key, PoolBlock data);
+
+    // Tells whether a block is worth reading whole: it is cached, being read
+    // or remembered. Otherwise remembers it now and counts a miss.
+    bool admit(const PoolKey& key, size_t size);
+
+    // Returns a cached block, or reads it with read and caches it. Only one
+    // read of a block runs at a time, concurrent callers share its result.
+    PoolBlock load(const PoolKey& key, const std::function<PoolBlock()>& read);
+
+    // Drops the blocks of a destroyed store
+    void eraseStore(int store_id);
+
+    // Line with the size and counters of the pool for List
+    std::string describe() const;
+};
+
+#endif // HEARTY_STORE_BUFFER_POOL_HPP
@@ -0,0 +1,219 @@
+/**
+ * @file hearty-store-crc32c.cpp
+ * @author Nathadon Samairat
+ * @brief CRC32C with a hardware and a table driven implementation. The
+ *        hardware one runs three independent lanes of the crc32 instruction
+ *        over large buffers and folds them together with zero-shift tables.
+ * @version 0.1
+ * @date 2024-12-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstring>
+#include "hearty-store-crc32c.hpp"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+const uint32_t CRC32C_POLY = 0x82F63B78;   // Castagnoli polynomial, reflected
+
+// Helper function to build the byte at a time lookup table
+static const uint32_t* crcTable() {
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            }
+            table[i] = crc;
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+// Helper function to run the table over a buffer, crc is not inverted here
+static uint32_t crc32cTable(uint32_t crc, const unsigned char* data, size_t size) {
+    const uint32_t* table = crcTable();
+    while (size--) {
+        crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// Helper function to multiply a 32x32 matrix over GF(2) by a vector
+static uint32_t gf2MatrixTimes(const uint32_t* matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; vector; vector >>= 1, matrix++) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+    }
+    return sum;
+}
+
+// Helper function to square a 32x32 matrix over GF(2)
+static void gf2MatrixSquare(uint32_t* square, const uint32_t* matrix) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2MatrixTimes(matrix, matrix[n]);
+    }
+}
+
+#if defined(__x86_64__)
+const size_t CRC32C_LONG = 8192;    // Bytes per lane of the long interleaved loop
+const size_t CRC32C_SHORT = 256;    // Bytes per lane of the short interleaved loop
+
+// Helper function to build the tables that advance a crc over length zero
+// bytes, length must be a power of two
+static void crcZerosTables(uint32_t tables[4][256], size_t length) {
+    // Operator for one zero bit, then squared up to length bytes
+    uint32_t odd[32];
+    uint32_t even[32];
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2MatrixSquare(even, odd);         // Two zero bits
+    gf2MatrixSquare(odd, even);         // Four zero bits
+    uint32_t* op = odd;
+    for (size_t bits = 4; bits < length * 8; bits *= 2) {
+        uint32_t* square = op == odd ? even : odd;
+        gf2MatrixSquare(square, op);
+        op = square;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        tables[0][n] = gf2MatrixTimes(op, n);
+        tables[1][n] = gf2MatrixTimes(op, n << 8);
+        tables[2][n] = gf2MatrixTimes(op, n << 16);
+        tables[3][n] = gf2MatrixTimes(op, n << 24);
+    }
+}
+
+// Helper function to advance a crc over the zero bytes of a table
+static inline uint32_t crcShift(const uint32_t tables[4][256], uint32_t crc) {
+    return tables[0][crc & 0xFF] ^ tables[1][(crc >> 8) & 0xFF] ^
+           tables[2][(crc >> 16) & 0xFF] ^ tables[3][crc >> 24];
+}
+
+// Helper function to run the crc32 instruction over three lanes of lane bytes
+// at once and fold them into one crc. The instruction has a latency of three
+// cycles but starts one per cycle, so independent lanes keep it busy.
+__attribute__((target("sse4.2")))
+static inline uint32_t crcLanes(uint32_t crc, const unsigned char*& data, size_t& size,
+                                size_t lane, const uint32_t shift[4][256]) {
+    while (size >= lane * 3) {
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        for (const unsigned char* end = data + lane; data < end; data += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, data, sizeof(word0));
+            memcpy(&word1, data + lane, sizeof(word1));
+            memcpy(&word2, data + lane * 2, sizeof(word2));
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc = crcShift(shift, static_cast<uint32_t>(crc0)) ^ static_cast<uint32_t>(crc1);
+        crc = crcShift(shift, crc) ^ static_cast<uint32_t>(crc2);
+        data += lane * 2;
+        size -= lane * 3;
+    }
+    return crc;
+}
+
+// Helper function to run the crc32 instruction eight bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, size_t size) {
+    static uint32_t long_shift[4][256];
+    static uint32_t short_shift[4][256];
+    static bool ready = [] {
+        crcZerosTables(long_shift, CRC32C_LONG);
+        crcZerosTables(short_shift, CRC32C_SHORT);
+        return true;
+    }();
+    (void)ready;
+
+    crc = crcLanes(crc, data, size, CRC32C_LONG, long_shift);
+    crc = crcLanes(crc, data, size, CRC32C_SHORT, short_shift);
+
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (size--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#if defined(__x86_64__)
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) {
+        return ~crc32cHardware(crc, bytes, size);
+    }
+#endif
+    return ~crc32cTable(crc, bytes, size);
+}
+
+uint32_t crc32cSoftware(uint32_t crc, const void* data, size_t size) {
+    return ~crc32cTable(~crc, static_cast<const unsigned char*>(data), size);
+}
+
+/**
+ * @brief Combines the CRC32C of two buffers into the CRC32C of the first
+ *        followed by the second, by running crc1 over length2 zero bytes.
+ *        The operator for one zero bit is squared once per bit of length2.
+ *
+ * @param crc1      - CRC of the first buffer.
+ * @param crc2      - CRC of the second buffer, started from 0.
+ * @param length2   - Size of the second buffer.
+ * @return The CRC of both buffers.
+ */
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, size_t length2) {
+    if (length2 == 0) {
+        return crc1;
+    }
+
+    uint32_t odd[32];
+    uint32_t even[32];
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2MatrixSquare(even, odd);         // Two zero bits
+    gf2MatrixSquare(odd, even);         // Four zero bits
+
+    // The first square is one zero byte, each next one doubles it
+    do {
+        gf2MatrixSquare(even, odd);
+        if (length2 & 1) {
+            crc1 = gf2MatrixTimes(even, crc1);
+        }
+        length2 >>= 1;
+        if (length2 == 0) {
+            break;
+        }
+        gf2MatrixSquare(odd, even);
+        if (length2 & 1) {
+            crc1 = gf2MatrixTimes(odd, crc1);
+        }
+        length2 >>= 1;
+    } while (length2 != 0);
+    return crc1 ^ crc2;
+}
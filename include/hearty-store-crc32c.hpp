@@ -0,0 +1,35 @@
+/**
+ * @file hearty-store-crc32c.hpp
+ * @author Nathadon Samairat
+ * @brief CRC32C (Castagnoli) checksums. Uses the SSE4.2 crc32 instruction
+ *        when the CPU has it and a lookup table otherwise.
+ * @version 0.1
+ * @date 2024-12-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_CRC32C_HPP
+#define HEARTY_STORE_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Extends a CRC32C over more data. Start with crc = 0; feeding a
+ *        buffer in pieces gives the same result as feeding it at once.
+ *
+ * @param crc   - CRC of the data so far.
+ * @param data  - Next bytes.
+ * @param size  - Number of bytes.
+ * @return The CRC including the new bytes.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+// The table driven CRC32C that crc32c() falls back to without SSE4.2, same results
+uint32_t crc32cSoftware(uint32_t crc, const void* data, size_t size);
+
+// CRC32C of two buffers back to back from the CRC of each, the second started from 0
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, size_t length2);
+
+#endif // HEARTY_STORE_CRC32C_HPP
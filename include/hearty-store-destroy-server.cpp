@@ -13,6 +13,8 @@
 #include <string>
 #include <filesystem>
 #include "hearty-store-server.hpp"
+#include "hearty-store-registry.hpp"
+#include "hearty-store-buffer-pool.hpp"
 namespace fs = std::filesystem;
 
 /**
@@ -30,6 +32,9 @@ bool destroy_store(int store_id) {
     }
 
     try {
+        // Drop the resident store first, which closes its files
+        StoreRegistry::instance().remove(store_id);
+        BufferPool::instance().eraseStore(store_id);
         fs::remove_all(store_path);
         std::cout << "Successfully removed store: " << store_id << std::endl;
         return true;
@@ -0,0 +1,95 @@
+/**
+ * @file hearty-store-engine.hpp
+ * @author Nathadon Samairat
+ * @brief Interface of the storage engines a store can be created with. Each
+ *        resident store owns its engine, and the Put, Get and List handlers
+ *        and the checkpoint thread go through it without knowing which
+ *        engine the store uses.
+ * @version 0.1
+ * @date 2024-12-20
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_ENGINE_HPP
+#define HEARTY_STORE_ENGINE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "hearty-store-server.hpp"
+#include "hearty-store-files.hpp"
+
+// One object of a Put, the views must outlive the call
+struct ObjectWrite {
+    std::string_view object_id;
+    std::string_view file_path;
+    std::string_view content;
+    const std::vector<uint32_t>* checksums = nullptr;   // CRC32C of each block of the content if known already
+};
+
+/**
+ * @brief A Put whose content arrives in pieces. append needs no store lock;
+ *        commit and abort are called with the store locked exclusively. A
+ *        stream that fails to commit still has to be aborted.
+ */
+class ObjectStream {
+public:
+    virtual ~ObjectStream() = default;
+
+    // Writes the next piece of the content
+    virtual bool append(const char* data, size_t size) = 0;
+
+    // Makes the object visible once all of its content is written
+    virtual bool commit() = 0;
+
+    // Gives the space of a stream that was not committed back
+    virtual void abort() = 0;
+};
+
+/**
+ * @brief Stores the objects of one store. Reads take the store lock shared
+ *        and writes exclusively, except where noted.
+ */
+class StorageEngine {
+public:
+    virtual ~StorageEngine() = default;
+
+    virtual bool contains(const std::string& object_id) const = 0;
+
+    // Size of an object's content, false if there is no such object
+    virtual bool size(const std::string& object_id, uint64_t& data_size) const = 0;
+
+    // Stores the objects as one transaction, a later object replaces an
+    // earlier one with the same path. Durable after the next sync.
+    virtual bool put(const std::vector<ObjectWrite>& writes) = 0;
+
+    // Starts a Put of data_size bytes whose content arrives in pieces, null if there is no room
+    virtual std::unique_ptr<ObjectStream> begin(const std::string& object_id, const std::string& file_path,
+                                                size_t data_size) = 0;
+
+    // Waits until every committed Put is on disk, called without the store lock
+    virtual bool sync() = 0;
+
+    // Read the bytes [offset, offset + length) of an object, a length of 0 reads to the end
+    virtual bool readChunks(const std::string& object_id, uint64_t offset, uint64_t length,
+                            const StoreFiles::ChunkCallback& on_chunk) const = 0;
+    virtual bool readMapped(const std::string& object_id, uint64_t offset, uint64_t length,
+                            MappedObject& object) const = 0;
+
+    // Reads whole objects; found is false for an object that does not exist or
+    // fails its checksum, false is only returned if the batch could not be read
+    virtual bool readBatch(const std::vector<std::string>& object_ids,
+                           std::vector<std::string>& contents, std::vector<bool>& found) const = 0;
+
+    // Background upkeep run by the checkpoint thread without the store lock
+    virtual void maintain() = 0;
+
+    // Usage of the store for List
+    virtual std::string describe() const = 0;
+};
+
+#endif // HEARTY_STORE_ENGINE_HPP
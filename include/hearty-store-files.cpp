@@ -0,0 +1,277 @@
+/**
+ * @file hearty-store-files.cpp
+ * @author Nathadon Samairat
+ * @brief Positioned I/O on the files of a store.
+ * @version 0.1
+ * @date 2024-12-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hearty-store-files.hpp"
+#include "hearty-store-server.hpp"
+#include "hearty-store-uring.hpp"
+
+// Helper function to read a whole buffer from a fixed offset
+static bool preadAll(int fd, void* buffer, size_t size, off_t offset) {
+    char* data = static_cast<char*>(buffer);
+    while (size > 0) {
+        ssize_t n = pread(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Helper function to write a whole buffer at a fixed offset
+static bool pwriteAll(int fd, const void* buffer, size_t size, off_t offset) {
+    const char* data = static_cast<const char*>(buffer);
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+DataMapping::~DataMapping() {
+    munmap(addr, length);
+}
+
+void DataMapping::prefetch(const char* data, size_t size) const {
+    // madvise wants a page aligned start
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    uintptr_t end = std::min(reinterpret_cast<uintptr_t>(data) + size,
+                             reinterpret_cast<uintptr_t>(addr) + length);
+    if (end > start) {
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+    }
+}
+
+void DataMapping::adviseSequential() const {
+    madvise(addr, length, MADV_SEQUENTIAL);
+}
+
+// Helper function to map a whole data file read-only
+static std::shared_ptr<const DataMapping> mapDataFile(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return nullptr;
+    }
+    return std::make_shared<DataMapping>(static_cast<char*>(addr), st.st_size);
+}
+
+/**
+ * @brief Opens data.bin and metadata.bin of a store for reading and writing,
+ *        and maps data.bin read-only. Large chunked reads get the sequential
+ *        hint: by default they read from the mapping, which is advised as a
+ *        whole. io_uring reads through descriptors instead, so there data.bin
+ *        is opened a second time for them; read-ahead state belongs to the
+ *        open file, so the hint leaves the first descriptor alone.
+ *
+ * @param store_id  - ID of the store.
+ * @return true if both files are open; false otherwise
+ */
+bool StoreFiles::open(int store_id) {
+    close();
+    data_fd = ::open(utils::getDataPath(store_id).c_str(), O_RDWR | O_CLOEXEC);
+    meta_fd = ::open(utils::getMetadataPath(store_id).c_str(), O_RDWR | O_CLOEXEC);
+    UringEngine* engine = UringEngine::active();
+    if (engine) {
+        stream_fd = ::open(utils::getDataPath(store_id).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (!isOpen() || (engine && stream_fd < 0)) {
+        std::cerr << "Failed to open the files of store " << store_id << std::endl;
+        close();
+        return false;
+    }
+
+    data_map = mapDataFile(data_fd);
+    if (!data_map) {
+        std::cerr << "Failed to map the data file of store " << store_id << std::endl;
+        close();
+        return false;
+    }
+
+    // Let the kernel read ahead aggressively
+    if (engine) {
+        posix_fadvise(stream_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        data_slot = engine->registerFile(data_fd);
+        meta_slot = engine->registerFile(meta_fd);
+        stream_slot = engine->registerFile(stream_fd);
+    } else {
+        data_map->adviseSequential();
+    }
+    return true;
+}
+
+void StoreFiles::close() {
+    if (UringEngine* engine = UringEngine::active()) {
+        engine->unregisterFile(data_slot);
+        engine->unregisterFile(meta_slot);
+        engine->unregisterFile(stream_slot);
+    }
+    data_slot = meta_slot = stream_slot = -1;
+    // Views handed out earlier keep their own reference to the mapping
+    data_map.reset();
+    if (data_fd >= 0) {
+        ::close(data_fd);
+        data_fd = -1;
+    }
+    if (meta_fd >= 0) {
+        ::close(meta_fd);
+        meta_fd = -1;
+    }
+    if (stream_fd >= 0) {
+        ::close(stream_fd);
+        stream_fd = -1;
+    }
+}
+
+bool StoreFiles::readData(void* buffer, size_t size, off_t offset) const {
+    if (UringEngine* engine = UringEngine::active()) {
+        return engine->read(data_fd, data_slot, buffer, size, offset);
+    }
+    return preadAll(data_fd, buffer, size, offset);
+}
+
+bool StoreFiles::writeData(const void* buffer, size_t size, off_t offset) const {
+    if (UringEngine* engine = UringEngine::active()) {
+        return engine->write(data_fd, data_slot, buffer, size, offset);
+    }
+    return pwriteAll(data_fd, buffer, size, offset);
+}
+
+bool StoreFiles::readMetadata(void* buffer, size_t size, off_t offset) const {
+    if (UringEngine* engine = UringEngine::active()) {
+        return engine->read(meta_fd, meta_slot, buffer, size, offset);
+    }
+    return preadAll(meta_fd, buffer, size, offset);
+}
+
+bool StoreFiles::writeMetadata(const void* buffer, size_t size, off_t offset) const {
+    if (UringEngine* engine = UringEngine::active()) {
+        return engine->write(meta_fd, meta_slot, buffer, size, offset);
+    }
+    return pwriteAll(meta_fd, buffer, size, offset);
+}
+
+bool StoreFiles::sync() const {
+    return fdatasync(data_fd) == 0 && fdatasync(meta_fd) == 0;
+}
+
+/**
+ * @brief Reads one contiguous range of data.bin into a list of buffers with
+ *        vectored reads, preadv or its io_uring counterpart. A short read
+ *        carries on from the buffer it stopped in.
+ *
+ * @param buffers   - Buffers to fill, in file order.
+ * @param offset    - Where the range starts.
+ * @return true if every buffer was filled; false otherwise
+ */
+bool StoreFiles::readDataVectored(std::vector<struct iovec> buffers, off_t offset) const {
+    UringEngine* engine = UringEngine::active();
+    size_t first = 0;
+    while (first < buffers.size()) {
+        if (buffers[first].iov_len == 0) {
+            first++;
+            continue;
+        }
+
+        int count = static_cast<int>(std::min<size_t>(buffers.size() - first, IOV_MAX));
+        ssize_t n;
+        if (engine) {
+            n = engine->readv(data_fd, data_slot, &buffers[first], count, offset);
+            if (n == -EINTR || n == -EAGAIN) {
+                continue;
+            }
+        } else {
+            n = preadv(data_fd, &buffers[first], count, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+        }
+        if (n <= 0) {
+            return false;
+        }
+        offset += n;
+
+        // Skip the buffers that are full, trim the one the read stopped in
+        while (n > 0) {
+            size_t take = std::min<size_t>(n, buffers[first].iov_len);
+            buffers[first].iov_base = static_cast<char*>(buffers[first].iov_base) + take;
+            buffers[first].iov_len -= take;
+            n -= take;
+            if (buffers[first].iov_len == 0) {
+                first++;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Reads a range of data.bin and hands it over in chunks of up to
+ *        GET_CHUNK_SIZE bytes, reading the next chunk while on_chunk sends
+ *        the current one. The io_uring engine reads into two registered
+ *        buffers, through the sequential descriptor for ranges of at least
+ *        SEQUENTIAL_READ_SIZE; otherwise the chunks point straight into the
+ *        mapping and the next one is prefetched into the page cache, which
+ *        is the read-ahead the hint would ask for: page faults on the
+ *        mapping do not follow the hints of a descriptor.
+ *
+ * @param offset    - Where the range starts.
+ * @param size      - Length of the range.
+ * @param on_chunk  - Called with each chunk, in order.
+ * @return true if the whole range was read; false otherwise
+ */
+bool StoreFiles::readDataChunks(off_t offset, size_t size, const ChunkCallback& on_chunk) const {
+    if (UringEngine* engine = UringEngine::active()) {
+        if (size >= SEQUENTIAL_READ_SIZE) {
+            return engine->readChunks(stream_fd, stream_slot, offset, size, on_chunk);
+        }
+        return engine->readChunks(data_fd, data_slot, offset, size, on_chunk);
+    }
+
+    if (!data_map || offset < 0 || offset + size > data_map->size()) {
+        return false;
+    }
+    const char* data = data_map->data() + offset;
+    for (size_t done = 0; done < size; done += GET_CHUNK_SIZE) {
+        if (done + GET_CHUNK_SIZE < size) {
+            data_map->prefetch(data + done + GET_CHUNK_SIZE, std::min(size - done - GET_CHUNK_SIZE, GET_CHUNK_SIZE));
+        }
+        on_chunk(data + done, std::min(size - done, GET_CHUNK_SIZE));
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file hearty-store-files.hpp
+ * @author Nathadon Samairat
+ * @brief Open file descriptors of a store. data.bin and metadata.bin are
+ *        opened once when the store is loaded or created and stay open for
+ *        as long as the store is resident; all block and metadata I/O goes
+ *        through positioned reads and writes on them, or through the
+ *        io_uring engine when the server runs with it. data.bin is also
+ *        mapped read-only so Get can hand out views of the page cache, and
+ *        opened once more read-only with POSIX_FADV_SEQUENTIAL for large
+ *        chunked reads, so their read-ahead window grows without changing
+ *        that of the random reads made through the first descriptor.
+ * @version 0.1
+ * @date 2024-12-11
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_FILES_HPP
+#define HEARTY_STORE_FILES_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Read-only mapping of a data.bin. Shared, so views into it stay valid after
+// the store is closed until the last holder lets go.
+class DataMapping {
+private:
+    char* addr;
+    size_t length;
+
+public:
+    DataMapping(char* addr, size_t length) : addr(addr), length(length) {}
+    ~DataMapping();
+
+    DataMapping(const DataMapping&) = delete;
+    DataMapping& operator=(const DataMapping&) = delete;
+
+    const char* data() const { return addr; }
+    size_t size() const { return length; }
+
+    // Asks the kernel to start reading a range in, without waiting for it
+    void prefetch(const char* data, size_t size) const;
+
+    // Tells the kernel the mapping is read front to back, so it reads ahead aggressively
+    void adviseSequential() const;
+};
+
+class StoreFiles {
+private:
+    int data_fd = -1;
+    int meta_fd = -1;
+    int stream_fd = -1;     // data.bin again for io_uring, read-only with sequential read-ahead
+    int data_slot = -1;     // Fixed file slots in the io_uring engine, -1 if unused
+    int meta_slot = -1;
+    int stream_slot = -1;
+    std::shared_ptr<const DataMapping> data_map;
+
+public:
+    // Receives each chunk of a chunked read, in file order
+    using ChunkCallback = std::function<void(const char* data, size_t size)>;
+
+    StoreFiles() = default;
+    ~StoreFiles() { close(); }
+
+    StoreFiles(const StoreFiles&) = delete;
+    StoreFiles& operator=(const StoreFiles&) = delete;
+
+    bool open(int store_id);
+    void close();
+    bool isOpen() const { return data_fd >= 0 && meta_fd >= 0; }
+
+    // The mapped data.bin, null while the store is closed
+    std::shared_ptr<const DataMapping> mapping() const { return data_map; }
+
+    // Reads or writes exactly size bytes at offset, into or from the caller's buffer
+    bool readData(void* buffer, size_t size, off_t offset) const;
+    bool writeData(const void* buffer, size_t size, off_t offset) const;
+    bool readMetadata(void* buffer, size_t size, off_t offset) const;
+    bool writeMetadata(const void* buffer, size_t size, off_t offset) const;
+
+    // Flushes the written data and metadata of both files to the disk
+    bool sync() const;
+
+    // Fills the buffers in order from one contiguous range of data.bin starting at offset
+    bool readDataVectored(std::vector<struct iovec> buffers, off_t offset) const;
+
+    // Reads a range of data.bin in chunks of up to GET_CHUNK_SIZE bytes
+    bool readDataChunks(off_t offset, size_t size, const ChunkCallback& on_chunk) const;
+};
+
+#endif // HEARTY_STORE_FILES_HPP
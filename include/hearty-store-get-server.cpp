@@ -14,72 +14,611 @@
 #include <fstream>
 #include <vector>
 #include <filesystem>
+#include <functional>
 #include "hearty-store-server.hpp"
+#include "hearty-store-registry.hpp"
+#include "hearty-store-buffer-pool.hpp"
+#include "hearty-store-crc32c.hpp"
+
+// Helper function to find the byte ranges of data.bin that hold an object, in
+// order, cut down to the bytes [offset, offset + length) of the object
+static bool objectRanges(const StoreState& store, const std::string& object_id,
+                         uint64_t offset, uint64_t length,
+                         std::vector<std::pair<off_t, size_t>>& ranges) {
+    // Find the record of the object
+    int record = store.index.find(object_id);
+
+    if (record == -1) {
+        std::cerr << "Object not found: " << object_id << std::endl;
+        return false;
+    }
+    const BlockMetadata& block = store.blocks[record];
+    size_t data_size = block.data_size;
+
+    // A slab object is a single slot, a large object a list of runs
+    size_t remaining = data_size;
+    if (block.size_class != 0) {
+        ranges.emplace_back(block.offset, data_size);
+        remaining = 0;
+    } else {
+        for (const Extent& extent : objectExtents(store, record)) {
+            size_t run_size = std::min(remaining, extent.num_blocks * BLOCK_SIZE);
+            ranges.emplace_back(static_cast<off_t>(extent.start_block) * BLOCK_SIZE, run_size);
+            remaining -= run_size;
+        }
+    }
+
+    if (remaining > 0) {
+        std::cerr << "Extents of " << object_id << " are shorter than the object" << std::endl;
+        return false;
+    }
+
+    // Keep only the requested bytes, a length of 0 reads to the end
+    if (offset > data_size) {
+        std::cerr << "Offset " << offset << " is past the end of " << object_id << std::endl;
+        return false;
+    }
+    size_t end = utils::rangeEnd(offset, length, data_size);
+    std::vector<std::pair<off_t, size_t>> clipped;
+    size_t position = 0;
+    for (const auto& [range_offset, range_size] : ranges) {
+        size_t from = std::max<size_t>(position, offset);
+        size_t to = std::min(position + range_size, end);
+        if (from < to) {
+            clipped.emplace_back(range_offset + (from - position), to - from);
+        }
+        position += range_size;
+    }
+    ranges.swap(clipped);
+    return true;
+}
+
+// Helper function to collect the checksum of each block of an object from its records
+static std::vector<uint32_t> blockChecksums(const StoreState& store, int record) {
+    const BlockMetadata& head = store.blocks[record];
+    if (head.size_class != 0) {
+        return {head.checksum};
+    }
+    std::vector<uint32_t> checksums;
+    for (const Extent& extent : objectExtents(store, record)) {
+        for (int b = 0; b < extent.num_blocks && checksums.size() * BLOCK_SIZE < head.data_size; b++) {
+            checksums.push_back(store.blocks[extent.start_block + b].checksum);
+        }
+    }
+    return checksums;
+}
 
 /**
- * @brief Retrieve an object by its ID from the store or reconstruct it if necessary.
+ * @brief Checks the content of a block store object against the checksums
+ *        in its block records as the bytes go by. Blocks a read covers only
+ *        partly and blocks without a checksum are not checked.
+ */
+class ChecksumVerifier {
+private:
+    std::string object_id;
+    std::vector<uint32_t> expected;     // Checksum of each block of the object
+    uint64_t data_size = 0;
+    uint64_t position = 0;              // Next byte of the object to come
+    bool whole_block = false;           // The current block was seen from its start
+    uint32_t crc = 0;
+
+public:
+    // Checks an object of size bytes whose bytes arrive from offset on
+    void start(const std::string& id, const std::vector<uint32_t>& checksums, uint64_t size, uint64_t offset) {
+        object_id = id;
+        expected = checksums;
+        data_size = size;
+        position = offset;
+        whole_block = offset % BLOCK_SIZE == 0;
+    }
+
+    // Loads the checksums of an object whose bytes arrive from offset on
+    void start(const StoreState& store, const std::string& id, uint64_t offset) {
+        int record = store.index.find(id);
+        if (record == -1) {
+            start(id, {}, 0, offset);
+            return;
+        }
+        start(id, blockChecksums(store, record), store.blocks[record].data_size, offset);
+    }
+
+    // Takes the next bytes of the object, false if a block does not match its checksum
+    bool feed(const char* data, size_t size) {
+        while (size > 0 && position < data_size) {
+            uint64_t block = position / BLOCK_SIZE;
+            uint64_t block_end = std::min<uint64_t>((block + 1) * BLOCK_SIZE, data_size);
+            size_t n = std::min<uint64_t>(size, block_end - position);
+            if (whole_block) {
+                crc = crc32c(crc, data, n);
+            }
+            data += n;
+            size -= n;
+            position += n;
+            if (position < block_end) {
+                continue;
+            }
+
+            if (whole_block && block < expected.size() && expected[block] != 0 && crc != expected[block]) {
+                std::cerr << "Checksum mismatch in block " << block << " of object " << object_id << std::endl;
+                return false;
+            }
+            whole_block = true;
+            crc = 0;
+        }
+        return true;
+    }
+};
+
+bool BlockEngine::contains(const std::string& object_id) const {
+    return store.index.find(object_id) != -1;
+}
+
+bool BlockEngine::size(const std::string& object_id, uint64_t& data_size) const {
+    int record = store.index.find(object_id);
+    if (record == -1) {
+        return false;
+    }
+    data_size = store.blocks[record].data_size;
+    return true;
+}
+
+// Helper function to copy bytes [from, from + size) of an object out of its mapped views
+static void copyMapped(const MappedObject& source, uint64_t from, size_t size, std::string& buffer) {
+    buffer.clear();
+    buffer.reserve(size);
+    uint64_t position = source.offset;
+    for (const auto& [data, range_size] : source.ranges) {
+        uint64_t begin = std::max(position, from);
+        uint64_t end = std::min<uint64_t>(position + range_size, from + size);
+        if (begin < end) {
+            buffer.append(data + (begin - position), end - begin);
+        }
+        position += range_size;
+    }
+}
+
+/**
+ * @brief Checks the block of a mapped object that holds byte position
+ *        against its checksum, reading it from the views without a copy.
+ *        A block the views cover only partly or that has no checksum is
+ *        passed unchecked. Called by the sender before it sends the first
+ *        byte of each block, so a Get hashes one block at a time.
+ *
+ * @param object_id     - ID of the object, for the error message.
+ * @param object        - The views and the checksums of the object.
+ * @param position      - Byte of the object about to be sent.
+ * @param checked       - Set to the end of the block, the bytes up to it may be sent.
+ * @return true if the block matches or is not checked; false otherwise
+ */
+bool checkMappedBlock(const std::string& object_id, const MappedObject& object, uint64_t position,
+                      uint64_t& checked) {
+    uint64_t block = position / BLOCK_SIZE;
+    uint64_t start = block * BLOCK_SIZE;
+    uint64_t block_end = std::min<uint64_t>(start + BLOCK_SIZE, object.data_size);
+    checked = block_end;
+    if (start < object.offset || block_end > object.end || block >= object.checksums.size() ||
+        object.checksums[block] == 0) {
+        return true;
+    }
+
+    uint32_t crc = 0;
+    uint64_t range_start = object.offset;
+    for (const auto& [data, size] : object.ranges) {
+        uint64_t begin = std::max(range_start, start);
+        uint64_t end = std::min<uint64_t>(range_start + size, block_end);
+        if (begin < end) {
+            crc = crc32c(crc, data + (begin - range_start), end - begin);
+        }
+        range_start += size;
+    }
+    if (crc != object.checksums[block]) {
+        std::cerr << "Checksum mismatch in block " << block << " of object " << object_id << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Helper function to decide whether bytes [offset, offset + length) of an
+// object are served from the buffer pool and, if so, to take the views of the
+// pool blocks holding them while the store is locked. The blocks are then
+// read from those views without the lock. A long read starting on a block not
+// seen lately is left to the store's own read path, so a cold sequential
+// read goes straight from disk and does not push hot blocks out; source is
+// null then.
+static bool mapPooled(const StoreState& store, int store_id, const std::string& object_id,
+                      uint64_t offset, uint64_t length, std::shared_ptr<MappedObject>& source) {
+    source.reset();
+    uint64_t data_size;
+    if (!store.engine->size(object_id, data_size)) {
+        std::cerr << "Object not found: " << object_id << std::endl;
+        return false;
+    }
+    if (offset > data_size) {
+        std::cerr << "Offset " << offset << " is past the end of " << object_id << std::endl;
+        return false;
+    }
+
+    uint64_t end = utils::rangeEnd(offset, length, data_size);
+    if (end - offset >= POOL_BYPASS_SIZE &&
+        !BufferPool::instance().admit({store_id, object_id, offset / POOL_BLOCK_SIZE}, POOL_BLOCK_SIZE)) {
+        return true;
+    }
+
+    uint64_t first = offset / POOL_BLOCK_SIZE * POOL_BLOCK_SIZE;
+    uint64_t last = std::min<uint64_t>(data_size, (end + POOL_BLOCK_SIZE - 1) / POOL_BLOCK_SIZE * POOL_BLOCK_SIZE);
+    source = std::make_shared<MappedObject>();
+    if (first < last && !store.engine->readMapped(object_id, first, last - first, *source)) {
+        return false;
+    }
+    source->offset = first;
+    source->data_size = data_size;
+    source->end = end;
+    return true;
+}
+
+// Helper function to get the piece of an object from position up to the end
+// of its pool block or of the read, whichever comes first. A block is copied
+// whole from the views of source and checked on the way in; hits are not
+// checked again. Object IDs are never reused for other content, so a cached
+// block stays valid as long as the object exists. Gets that miss the same
+// block at once share a single copy. A block that was not seen lately and
+// is read only partly is copied and checked all the same, it just does not
+// go into the pool.
+static bool pooledPiece(int store_id, const std::string& object_id, const MappedObject& source,
+                        uint64_t position, ObjectPiece& piece) {
+    BufferPool& pool = BufferPool::instance();
+    uint64_t block = position / POOL_BLOCK_SIZE;
+    uint64_t start = block * POOL_BLOCK_SIZE;
+    uint64_t block_end = std::min<uint64_t>(start + POOL_BLOCK_SIZE, source.data_size);
+    uint64_t to = std::min(block_end, source.end);
+    auto read_block = [&]() -> PoolBlock {
+        auto content = std::make_shared<std::string>();
+        copyMapped(source, start, block_end - start, *content);
+        ChecksumVerifier verifier;
+        verifier.start(object_id, source.checksums, source.data_size, start);
+        if (!verifier.feed(content->data(), content->size())) {
+            return nullptr;
+        }
+        return content;
+    };
+
+    PoolKey key{store_id, object_id, block};
+    bool partial = (position > start || to < block_end) && !pool.admit(key, block_end - start);
+    PoolBlock data = partial ? read_block() : pool.load(key, read_block);
+    if (!data) {
+        return false;
+    }
+    piece = {data, position - start, to - position};
+    return true;
+}
+
+/**
+ * @brief Reads an object by its ID and hands it over in chunks of up to
+ *        GET_CHUNK_SIZE bytes. Each run of the object is read front to back,
+ *        one chunk ahead of the caller, so large objects come off disk
+ *        sequentially and a reader never holds more than two chunks. With
+ *        the buffer pool on, the chunks are cut from pooled blocks instead.
  * 
  * @param store_id      - ID of the store.
  * @param object_id     - ID of the object to retrieve.
- * @return true         - Successfully retrieved the object.
- * @return false        - Failed to retrieve the object.
+ * @param offset        - First byte of the object to read.
+ * @param length        - Number of bytes to read, 0 reads to the end.
+ * @param on_chunk      - Called with each chunk, in order.
+ * @return true         - Successfully read the requested bytes.
+ * @return false        - Failed to find or read the object.
  */
-std::string get(int store_id, const std::string object_id) {
-    // Check if we need to recover first
-    recoverFromLog(store_id);
-    
-    // Load metadata
-    StoreMetadata store_metadata{};
-    std::vector<BlockMetadata> block_metadata(NUM_BLOCKS);
-    
-    std::ifstream meta_file(utils::getMetadataPath(store_id), std::ios::binary);
-    if (!meta_file) {
-        std::cerr << "Failed to open metadata file" << std::endl;
-        return "";
+bool getChunks(int store_id, const std::string& object_id, uint64_t offset, uint64_t length,
+               const StoreFiles::ChunkCallback& on_chunk) {
+    // Use the resident metadata, no metadata or log I/O after the first access
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to load metadata of store " << store_id << std::endl;
+        return false;
     }
 
-    // Read metadata
-    meta_file.read(reinterpret_cast<char*>(&store_metadata), sizeof(StoreMetadata));
-    for (auto& block : block_metadata) {
-        meta_file.read(reinterpret_cast<char*>(&block), sizeof(BlockMetadata));
-        if (meta_file.fail()) {
-            std::cerr << "Failed to read block metadata" << std::endl;
-            return {};
+    // Popular objects are served from the buffer pool, one block at a time
+    if (BufferPool::instance().enabled()) {
+        std::shared_ptr<MappedObject> source;
+        if (!mapPooled(*store, store_id, object_id, offset, length, source)) {
+            return false;
+        }
+        for (uint64_t position = offset; source && position < source->end;) {
+            ObjectPiece piece;
+            if (!pooledPiece(store_id, object_id, *source, position, piece)) {
+                return false;
+            }
+            for (size_t done = 0; done < piece.size; done += GET_CHUNK_SIZE) {
+                on_chunk(piece.data->data() + piece.from + done, std::min(piece.size - done, GET_CHUNK_SIZE));
+            }
+            position += piece.size;
         }
+        if (source) {
+            return true;
+        }
+    }
+
+    return store->engine->readChunks(object_id, offset, length, on_chunk);
+}
+
+// Reads each run front to back. Before the first byte of a block goes out,
+// the whole block is checked from the mapping of data.bin, so nothing of a
+// damaged block is sent and the chunks are passed on as they are read; a
+// block that fails its checksum ends the stream.
+bool BlockEngine::readChunks(const std::string& object_id, uint64_t offset, uint64_t length,
+                             const StoreFiles::ChunkCallback& on_chunk) const {
+    MappedObject object;
+    if (!readMapped(object_id, offset, length, object)) {
+        return false;
     }
 
-    // Find block with matching object id
-    int block_num = -1;
-    for (size_t i = 0; i < NUM_BLOCKS; i++) {
-        if (block_metadata[i].is_used && 
-            strncmp(block_metadata[i].object_id, object_id.c_str(), 
-                    sizeof(block_metadata[i].object_id) - 1) == 0) {
-            block_num = i;
-            break;
+    uint64_t position = offset;
+    uint64_t checked = offset;      // Bytes before this were checked or are not checked
+    bool intact = true;
+    for (const auto& [data, size] : object.ranges) {
+        off_t file_offset = data - object.mapping->data();
+        bool read = store.files.readDataChunks(file_offset, size, [&](const char* chunk, size_t chunk_size) {
+            while (intact && chunk_size > 0) {
+                if (position >= checked && !checkMappedBlock(object_id, object, position, checked)) {
+                    intact = false;
+                    break;
+                }
+                size_t n = std::min<uint64_t>(chunk_size, checked - position);
+                on_chunk(chunk, n);
+                chunk += n;
+                chunk_size -= n;
+                position += n;
+            }
+        });
+        if (!read) {
+            std::cerr << "Failed to read block data" << std::endl;
+            return false;
         }
     }
+    return intact;
+}
 
-    if (block_num == -1) {
-        std::cerr << "Object not found: " << object_id << std::endl;
-        return "";
+/**
+ * @brief Looks up an object without copying it: the result points into the
+ *        read-only mapping of data.bin, so the bytes go from the page cache
+ *        to the socket without a copy. The checksums of its blocks go
+ *        along, and the sender checks each block with checkMappedBlock
+ *        before it sends any of it. The caller holds the store read locked
+ *        for the call only: the result pins the object's space, so a Put replacing
+ *        the object meanwhile does not reuse it while the views are in use.
+ *        With the buffer pool on, the result has no views but fetches the
+ *        pool blocks of the requested bytes one by one as they are sent.
+ *
+ * @param store_id      - ID of the store.
+ * @param object_id     - ID of the object to retrieve.
+ * @param offset        - First byte of the object to read.
+ * @param length        - Number of bytes to read, 0 reads to the end.
+ * @param object        - Receives the views of the requested bytes, or how to fetch them from the pool.
+ * @return true         - The object was found and lies inside the mapping.
+ * @return false        - Failed to find the object.
+ */
+bool getMapped(int store_id, const std::string& object_id, uint64_t offset, uint64_t length,
+               MappedObject& object) {
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to load metadata of store " << store_id << std::endl;
+        return false;
+    }
+
+    // With the buffer pool on, the sender fetches the pool blocks one at a
+    // time as it reaches them, so a Get holds no more than the chunks in flight
+    object = MappedObject{};
+    if (BufferPool::instance().enabled()) {
+        std::shared_ptr<MappedObject> source;
+        if (!mapPooled(*store, store_id, object_id, offset, length, source)) {
+            return false;
+        }
+        if (source) {
+            object.offset = offset;
+            object.data_size = source->data_size;
+            object.end = source->end;
+            object.read_piece = [store_id, object_id, source](uint64_t position, ObjectPiece& piece) {
+                return pooledPiece(store_id, object_id, *source, position, piece);
+            };
+            return true;
+        }
+    }
+
+    // The views are checked block by block as they are sent
+    return store->engine->readMapped(object_id, offset, length, object);
+}
+
+// Points the views into the mapping of data.bin and pins the object's space.
+// The checksums of its blocks go along, the caller checks the views.
+bool BlockEngine::readMapped(const std::string& object_id, uint64_t offset, uint64_t length,
+                             MappedObject& object) const {
+    std::vector<std::pair<off_t, size_t>> ranges;
+    if (!objectRanges(store, object_id, offset, length, ranges)) {
+        return false;
+    }
+
+    int record = store.index.find(object_id);
+    object.mapping = store.files.mapping();
+    object.pin = store.pins->pin(record);
+    object.offset = offset;
+    object.end = offset;
+    object.data_size = store.blocks[record].data_size;
+    object.checksums = blockChecksums(store, record);
+    for (const auto& [offset, size] : ranges) {
+        if (!object.mapping || offset + size > object.mapping->size()) {
+            std::cerr << "Object " << object_id << " lies outside the data file" << std::endl;
+            return false;
+        }
+        object.ranges.emplace_back(object.mapping->data() + offset, size);
+        object.end += size;
+    }
+    return true;
+}
+
+// The pieces of all objects are sorted by their place in data.bin and
+// neighbouring pieces are read with one vectored read straight into the
+// object buffers; the gaps between them go to a scratch buffer.
+bool BlockEngine::readBatch(const std::vector<std::string>& object_ids,
+                            std::vector<std::string>& contents, std::vector<bool>& found) const {
+    // Size every object's buffer, then note where each of its pieces goes
+    struct Piece {
+        off_t offset;
+        size_t size;
+        char* buffer;
+    };
+    std::vector<Piece> pieces;
+    contents.assign(object_ids.size(), "");
+    found.assign(object_ids.size(), false);
+    for (size_t i = 0; i < object_ids.size(); i++) {
+        std::vector<std::pair<off_t, size_t>> ranges;
+        if (!objectRanges(store, object_ids[i], 0, 0, ranges)) {
+            continue;
+        }
+        found[i] = true;
+
+        size_t total = 0;
+        for (const auto& range : ranges) {
+            total += range.second;
+        }
+        contents[i].resize(total);
+        size_t position = 0;
+        for (const auto& [offset, size] : ranges) {
+            pieces.push_back({offset, size, &contents[i][position]});
+            position += size;
+        }
+    }
+    std::sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) {
+        return a.offset < b.offset;
+    });
+
+    // Merge neighbouring pieces into one read, reading over small gaps
+    std::string scratch(BATCH_READ_GAP, '\0');
+    size_t i = 0;
+    while (i < pieces.size()) {
+        off_t start = pieces[i].offset;
+        off_t end = start + pieces[i].size;
+        std::vector<struct iovec> buffers{{pieces[i].buffer, pieces[i].size}};
+        for (i++; i < pieces.size(); i++) {
+            off_t gap = pieces[i].offset - end;
+            if (gap < 0 || static_cast<size_t>(gap) > BATCH_READ_GAP) {
+                break;
+            }
+            if (gap > 0) {
+                buffers.push_back({&scratch[0], static_cast<size_t>(gap)});
+            }
+            buffers.push_back({pieces[i].buffer, pieces[i].size});
+            end = pieces[i].offset + pieces[i].size;
+        }
+
+        if (!store.files.readDataVectored(buffers, start)) {
+            std::cerr << "Failed to read block data" << std::endl;
+            return false;
+        }
+    }
+
+    // A damaged object is reported like a missing one, the rest of the batch is still returned
+    for (size_t i = 0; i < object_ids.size(); i++) {
+        ChecksumVerifier verifier;
+        verifier.start(store, object_ids[i], 0);
+        if (found[i] && !verifier.feed(contents[i].data(), contents[i].size())) {
+            found[i] = false;
+            contents[i].clear();
+        }
     }
+    return true;
+}
+
+/**
+ * @brief Reads many objects of a store at once. Objects whose blocks are all
+ *        in the buffer pool are copied from memory; the rest are read from
+ *        disk together, where pieces that lie close together, like small
+ *        objects sharing a slab, are read with a single vectored read, and
+ *        their blocks are then added to the pool.
+ *
+ * @param store_id      - ID of the store.
+ * @param object_ids    - IDs of the objects to retrieve.
+ * @param contents      - Receives the content of each object, in request order.
+ * @param found         - Receives whether each object exists.
+ * @return true         - Every object that exists was read, a damaged one is reported as not found.
+ * @return false        - The store could not be loaded or a read failed.
+ */
+bool getBatch(int store_id, const std::vector<std::string>& object_ids,
+              std::vector<std::string>& contents, std::vector<bool>& found) {
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to load metadata of store " << store_id << std::endl;
+        return false;
+    }
+    BufferPool& pool = BufferPool::instance();
+    if (!pool.enabled()) {
+        return store->engine->readBatch(object_ids, contents, found);
+    }
+
+    // Assemble the objects that are fully resident, collect the others
+    std::vector<std::string> missing;
+    std::vector<size_t> missing_at;
+    contents.assign(object_ids.size(), "");
+    found.assign(object_ids.size(), false);
+    for (size_t i = 0; i < object_ids.size(); i++) {
+        uint64_t data_size;
+        if (!store->engine->size(object_ids[i], data_size)) {
+            std::cerr << "Object not found: " << object_ids[i] << std::endl;
+            continue;
+        }
+        found[i] = true;
+
+        contents[i].reserve(data_size);
+        for (uint64_t block = 0; block * POOL_BLOCK_SIZE < data_size; block++) {
+            PoolBlock data = pool.lookup({store_id, object_ids[i], block});
+            if (!data) {
+                contents[i].clear();
+                missing.push_back(object_ids[i]);
+                missing_at.push_back(i);
+                break;
+            }
+            contents[i].append(*data);
+        }
+    }
+    if (missing.empty()) {
+        return true;
+    }
+
+    std::vector<std::string> missing_contents;
+    std::vector<bool> missing_found;
+    if (!store->engine->readBatch(missing, missing_contents, missing_found)) {
+        return false;
+    }
+    for (size_t j = 0; j < missing.size(); j++) {
+        size_t i = missing_at[j];
+        found[i] = missing_found[j];
+        contents[i] = std::move(missing_contents[j]);
+        for (uint64_t start = 0; start < contents[i].size(); start += POOL_BLOCK_SIZE) {
+            pool.insert({store_id, missing[j], start / POOL_BLOCK_SIZE},
+                        std::make_shared<const std::string>(contents[i], start, POOL_BLOCK_SIZE));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Retrieve an object by its ID from the store or reconstruct it if necessary.
+ * 
+ * @param store_id      - ID of the store.
+ * @param object_id     - ID of the object to retrieve.
+ * @return The content of the object, or an empty string on failure.
+ */
+std::string get(int store_id, const std::string object_id) {
+    std::string content;
+    bool success = getChunks(store_id, object_id, 0, 0, [&content](const char* data, size_t size) {
+        content.append(data, size);
+    });
 
-    // Read data
-    std::ifstream data_file(utils::getDataPath(store_id), std::ios::binary);
-    data_file.seekg(block_num * BLOCK_SIZE);
-    std::vector<char> buffer(block_metadata[block_num].data_size);
-    data_file.read(buffer.data(), block_metadata[block_num].data_size);
-    
-    if (!data_file) {
-        std::cerr << "Failed to read block data" << std::endl;
+    if (!success) {
         return "";
     }
 
-    if (buffer.empty()) {
+    if (content.empty()) {
         std::cerr << "Buffer is empty" << std::endl;
         return "";
     }
-    
-    // Create string from buffer without assuming null-termination
-    return std::string(buffer.data(), block_metadata[block_num].data_size);
-}
\ No newline at end of file
+    return content;
+}
@@ -14,16 +14,71 @@
 #include <filesystem>
 #include <string>
 #include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 #include "hearty-store-server.hpp"
+#include "hearty-store-registry.hpp"
+
+// Helper function to write the engine file of a new store. It is written to
+// a temporary file and renamed into place, so a crash leaves either no engine
+// file or a complete one.
+static bool writeEngineFile(int store_id, const std::string& engine_name) {
+    std::string engine_path = utils::getEnginePath(store_id);
+    std::string temp_path = engine_path + ".tmp";
+    int engine_fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string content = engine_name + "\n";
+    bool success = engine_fd >= 0 &&
+                   write(engine_fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) &&
+                   fsync(engine_fd) == 0;
+    if (engine_fd >= 0) {
+        close(engine_fd);
+    }
+    if (!success || rename(temp_path.c_str(), engine_path.c_str()) != 0) {
+        std::cerr << "Failed to write engine file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // The rename is durable once the directory is
+    int dir_fd = open(utils::getStorePath(store_id).c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return true;
+}
+
+// Helper function to create a log-structured store, which starts out as an
+// engine file and gets its first segment with the first Put
+static bool initializeLogStructured(int store_id, const std::string& store_path) {
+    if (!writeEngineFile(store_id, "log")) {
+        std::filesystem::remove_all(store_path);
+        return false;
+    }
+
+    auto store = std::make_shared<StoreState>();
+    auto log_structured = std::make_unique<LogStructuredStore>();
+    store->store_id = store_id;
+    if (!log_structured->open(store_id)) {
+        std::filesystem::remove_all(store_path);
+        return false;
+    }
+    store->engine = std::move(log_structured);
+    StoreRegistry::instance().add(store);
+    return true;
+}
 
 /**
  * @brief Initializes a new store with the given ID.
  * 
  * @param store_id ID of the store to initialize.
+ * @param preallocate Reserve disk space for every block instead of leaving
+ *                    data.bin sparse.
+ * @param engine Storage engine of the store.
  * 
  * @return true if the store is successfully initialized; false otherwise
  */
-bool initialize(int store_id) {
+bool initialize(int store_id, bool preallocate, StoreEngine engine) {
     // Check if store already exists
     std::string store_path = BASE_PATH + STORE_DIR + std::to_string(store_id);
     if (utils::storeExists(store_id)) {
@@ -39,66 +94,78 @@ bool initialize(int store_id) {
         return false;
     }
 
+    if (engine == StoreEngine::LOG_STRUCTURED) {
+        return initializeLogStructured(store_id, store_path);
+    }
+
     // Initialize metadata
     StoreMetadata store_metadata{
+        .magic = STORE_MAGIC,
+        .format_version = STORE_FORMAT_VERSION,
         .store_id = store_id,
         .total_blocks = NUM_BLOCKS,
+        .total_records = NUM_BLOCKS,    // Slab records are added as small objects arrive
         .block_size = BLOCK_SIZE,
         .used_blocks = 0,
     };
-    std::vector<BlockMetadata> block_metadata(NUM_BLOCKS);  // Zero-initialized by default
+    std::vector<BlockMetadata> block_metadata(store_metadata.total_records);  // Zero-initialized by default
 
-    // Create and write metadata file
+    // Create the metadata file: the header followed by an all-zero record table.
+    // The table is extended with ftruncate, zero records are unused.
     std::string meta_path = store_path + META_FILENAME;
     {
-        std::ofstream meta_file(meta_path, std::ios::binary);
-        if (!meta_file) {
+        int meta_fd = open(meta_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (meta_fd < 0) {
             std::cerr << "Failed to create metadata file" << std::endl;
             std::filesystem::remove_all(store_path);
             return false;
         }
 
-        meta_file.write(reinterpret_cast<const char*>(&store_metadata), sizeof(StoreMetadata));
-        for (const auto& block : block_metadata) {
-            meta_file.write(reinterpret_cast<const char*>(&block), sizeof(BlockMetadata));
-            if (meta_file.fail()) {
-                std::cerr << "Failed to write block metadata" << std::endl;
-                return false;
-            }
-        }
-
-        if (meta_file.fail()) {
+        off_t meta_size = sizeof(StoreMetadata) + store_metadata.total_records * sizeof(BlockMetadata);
+        bool success = write(meta_fd, &store_metadata, sizeof(StoreMetadata)) == sizeof(StoreMetadata) &&
+                       ftruncate(meta_fd, meta_size) == 0;
+        close(meta_fd);
+        if (!success) {
             std::cerr << "Failed to write metadata" << std::endl;
             std::filesystem::remove_all(store_path);
             return false;
         }
     }
 
-    // Create and initialize data file
+    // Create the data file without writing it: sparse by default, or with
+    // every block reserved up front when preallocation is requested
     std::string data_path = store_path + DATA_FILENAME;
     {
-        std::ofstream data_file(data_path, std::ios::binary);
-        if (!data_file) {
+        int data_fd = open(data_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (data_fd < 0) {
             std::cerr << "Failed to create data file" << std::endl;
             std::filesystem::remove_all(store_path);
             return false;
         }
 
-        // Initialize the data file with zeros for all blocks
-        std::vector<char> zeros(NUM_BLOCKS * BLOCK_SIZE, '\0');
-        data_file.write(zeros.data(), zeros.size());
-        if (data_file.fail()) {
-            std::cerr << "Failed to initialize data file" << std::endl;
+        off_t data_size = static_cast<off_t>(NUM_BLOCKS) * BLOCK_SIZE;
+        int error = preallocate ? posix_fallocate(data_fd, 0, data_size)
+                                : (ftruncate(data_fd, data_size) == 0 ? 0 : errno);
+        close(data_fd);
+        if (error != 0) {
+            std::cerr << "Failed to size data file: " << std::strerror(error) << std::endl;
             std::filesystem::remove_all(store_path);
             return false;
         }
+    }
 
-        if (data_file.fail()) {
-            std::cerr << "Failed to write data" << std::endl;
-            std::filesystem::remove_all(store_path);
-            return false;
-        }
+    // Keep the fresh metadata resident for the following requests
+    auto store = std::make_shared<StoreState>();
+    store->store_id = store_id;
+    store->metadata = store_metadata;
+    store->blocks = std::move(block_metadata);
+    if (!store->files.open(store_id) || !store->log.open(store_id, store->files)) {
+        std::filesystem::remove_all(store_path);
+        return false;
     }
+    buildIndexes(*store);
+    store->engine = std::make_unique<BlockEngine>(*store);
+    StoreRegistry::instance().add(store);
 
     return true;
 }
\ No newline at end of file
@@ -13,6 +13,8 @@
 #include <fstream>
 #include <iomanip>
 #include "hearty-store-server.hpp"
+#include "hearty-store-registry.hpp"
+#include "hearty-store-buffer-pool.hpp"
 
 /**
  * @brief Lists all available stores and their metadata.
@@ -24,21 +26,12 @@ std::string list_stores() {
     }
 
     bool found_stores = false;
-    StoreMetadata metadata{};
     std::stringstream output;
 
-    for (const auto& entry : std::filesystem::directory_iterator(BASE_PATH)) {
-        if (!entry.is_directory()) continue;
-
-        std::string dirname = entry.path().filename().string();
-        if (dirname.substr(0, 6) != "store_") continue;
-
-        int store_id = std::stoi(dirname.substr(6));
+    for (int store_id : utils::getStoreIds()) {
+        std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
         
-        std::string metadata_path = BASE_PATH + "/store_" + std::to_string(store_id) + META_FILENAME;
-        std::ifstream meta_file(metadata_path, std::ios::binary);
-        
-        if (meta_file && meta_file.read(reinterpret_cast<char*>(&metadata), sizeof(StoreMetadata))) {
+        if (store) {
             found_stores = true;
             
             std::string status;
@@ -46,13 +39,18 @@ std::string list_stores() {
                 status = "active";
             }
 
-            output << metadata.store_id << " - " 
-                  << status 
-                  << " (used: " << metadata.used_blocks << "/"
-                  << metadata.total_blocks << " blocks)"
-                  << std::endl;
+            output << store->store_id << " - " << status
+                   << " (" << store->engine->describe() << ")" << std::endl;
         }
     }
 
-    return found_stores ? output.str() : "No store found";
+    if (!found_stores) {
+        return "No store found";
+    }
+
+    // The pool is shared by all stores
+    if (BufferPool::instance().enabled()) {
+        output << BufferPool::instance().describe() << std::endl;
+    }
+    return output.str();
 }
\ No newline at end of file
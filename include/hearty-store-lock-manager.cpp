@@ -0,0 +1,168 @@
+/**
+ * @file hearty-store-lock-manager.cpp
+ * @author Nathadon Samairat
+ * @brief Implements the per-store reader/writer locks used by the server.
+ * @version 0.1
+ * @date 2024-12-05
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include "hearty-store-lock-manager.hpp"
+
+// Helper function to move the head of the queue past timed out tickets
+void StoreLock::advanceQueue() {
+    now_serving++;
+    while (abandoned.erase(now_serving) > 0) {
+        now_serving++;
+    }
+}
+
+/**
+ * @brief Waits in line for the lock in the given mode.
+ *
+ * @param mode      - SHARED for readers, EXCLUSIVE for writers.
+ * @param timeout   - How long to wait before giving up.
+ * @return true     - The lock is held by the caller.
+ * @return false    - The wait timed out; the caller holds nothing.
+ */
+bool StoreLock::acquire(LockMode mode, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t ticket = next_ticket++;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    auto can_enter = [&] {
+        if (now_serving != ticket || writer) {
+            return false;
+        }
+        return mode == LockMode::SHARED || readers == 0;
+    };
+
+    if (!cv.wait_until(lock, deadline, can_enter)) {
+        // Leave the queue without stalling the requests behind us
+        if (now_serving == ticket) {
+            advanceQueue();
+        } else {
+            abandoned.insert(ticket);
+        }
+        cv.notify_all();
+        return false;
+    }
+
+    if (mode == LockMode::SHARED) {
+        readers++;
+    } else {
+        writer = true;
+    }
+
+    // Let the next request in line check whether it can enter as well
+    advanceQueue();
+    cv.notify_all();
+    return true;
+}
+
+/**
+ * @brief Releases a lock previously taken with acquire().
+ *
+ * @param mode - The mode the lock was acquired in.
+ */
+void StoreLock::release(LockMode mode) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (mode == LockMode::SHARED) {
+            readers--;
+        } else {
+            writer = false;
+        }
+    }
+    cv.notify_all();
+}
+
+// Helper function to find or create the lock of a store and count the caller as a user
+StoreLock& StoreLockManager::useLock(int store_id) {
+    std::lock_guard<std::mutex> lock(table_lock);
+    std::unique_ptr<StoreLock>& store_lock = locks[store_id];
+    if (!store_lock) {
+        store_lock = std::make_unique<StoreLock>();
+    }
+    store_lock->users++;
+    return *store_lock;
+}
+
+// Helper function to stop counting the caller as a user, the last one removes the lock
+void StoreLockManager::dropLock(int store_id) {
+    std::lock_guard<std::mutex> lock(table_lock);
+    auto it = locks.find(store_id);
+    if (it != locks.end() && --it->second->users == 0) {
+        locks.erase(it);
+    }
+}
+
+/**
+ * @brief Locks a store, waiting at most timeout.
+ *
+ * @param store_id  - ID of the store.
+ * @param mode      - SHARED for readers, EXCLUSIVE for writers.
+ * @param timeout   - How long to wait before giving up.
+ * @return true if the lock was acquired; false on timeout
+ */
+bool StoreLockManager::lock(int store_id, LockMode mode, std::chrono::milliseconds timeout) {
+    if (!useLock(store_id).acquire(mode, timeout)) {
+        dropLock(store_id);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Unlocks a store locked with lock(). The caller still counts as a
+ *        user while it releases, so the lock outlives the release.
+ *
+ * @param store_id  - ID of the store.
+ * @param mode      - The mode the lock was acquired in.
+ */
+void StoreLockManager::unlock(int store_id, LockMode mode) {
+    StoreLock* store_lock;
+    {
+        std::lock_guard<std::mutex> lock(table_lock);
+        store_lock = locks.at(store_id).get();
+    }
+    store_lock->release(mode);
+    dropLock(store_id);
+}
+
+StoreLockGuard::StoreLockGuard(StoreLockManager& manager, int store_id, LockMode mode)
+    : StoreLockGuard(manager, std::vector<int>{store_id}, mode) {}
+
+StoreLockGuard::StoreLockGuard(StoreLockManager& manager, std::vector<int> store_ids, LockMode mode)
+    : manager(manager), mode(mode), owns(true) {
+    std::sort(store_ids.begin(), store_ids.end());
+    store_ids.erase(std::unique(store_ids.begin(), store_ids.end()), store_ids.end());
+
+    auto deadline = std::chrono::steady_clock::now() + LOCK_TIMEOUT;
+    for (int store_id : store_ids) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() < 0 || !manager.lock(store_id, mode, remaining)) {
+            owns = false;
+            break;
+        }
+        held.push_back(store_id);
+    }
+
+    // All or nothing
+    if (!owns) {
+        for (auto it = held.rbegin(); it != held.rend(); ++it) {
+            manager.unlock(*it, mode);
+        }
+        held.clear();
+    }
+}
+
+StoreLockGuard::~StoreLockGuard() {
+    for (auto it = held.rbegin(); it != held.rend(); ++it) {
+        manager.unlock(*it, mode);
+    }
+}
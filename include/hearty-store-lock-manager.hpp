@@ -0,0 +1,98 @@
+/**
+ * @file hearty-store-lock-manager.hpp
+ * @author Nathadon Samairat
+ * @brief Per-store reader/writer locks. Requests queue up in arrival order and
+ *        give up after a bounded wait instead of being rejected immediately.
+ * @version 0.1
+ * @date 2024-12-05
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_LOCK_MANAGER_HPP
+#define HEARTY_STORE_LOCK_MANAGER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+const std::chrono::milliseconds LOCK_TIMEOUT(5000);    // Max wait for a store lock
+
+enum class LockMode {
+    SHARED,         // Readers (Get, List) of a store
+    EXCLUSIVE       // Writers (Init, Put, Destroy) of a store
+};
+
+/**
+ * @brief A fair reader/writer lock for a single store.
+ *
+ * Every request takes a ticket and waits until it reaches the head of the
+ * queue. Consecutive readers pass through together, while a writer waits for
+ * the readers ahead of it to drain and holds back the ones behind it.
+ */
+class StoreLock {
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t next_ticket = 0;       // Ticket given to the next arriving request
+    uint64_t now_serving = 0;       // Ticket at the head of the queue
+    std::set<uint64_t> abandoned;   // Tickets whose owner timed out while queued
+    int readers = 0;                // Number of shared holders
+    bool writer = false;            // Whether an exclusive holder exists
+
+    void advanceQueue();
+
+public:
+    int users = 0;                  // Holders and waiters, guarded by the manager's table_lock
+
+    bool acquire(LockMode mode, std::chrono::milliseconds timeout);
+    void release(LockMode mode);
+};
+
+/**
+ * @brief Hands out the StoreLock for each store id. A lock exists only while
+ *        someone holds or waits for it, so destroyed stores leave nothing behind.
+ */
+class StoreLockManager {
+private:
+    std::mutex table_lock;
+    std::unordered_map<int, std::unique_ptr<StoreLock>> locks;
+
+    StoreLock& useLock(int store_id);
+    void dropLock(int store_id);
+
+public:
+    bool lock(int store_id, LockMode mode, std::chrono::milliseconds timeout = LOCK_TIMEOUT);
+    void unlock(int store_id, LockMode mode);
+};
+
+/**
+ * @brief Holds one or more store locks for the lifetime of a request.
+ *
+ * Multiple stores are locked in ascending id order so two guards can never
+ * wait on each other.
+ */
+class StoreLockGuard {
+private:
+    StoreLockManager& manager;
+    std::vector<int> held;
+    LockMode mode;
+    bool owns;
+
+public:
+    StoreLockGuard(StoreLockManager& manager, int store_id, LockMode mode);
+    StoreLockGuard(StoreLockManager& manager, std::vector<int> store_ids, LockMode mode);
+    ~StoreLockGuard();
+
+    StoreLockGuard(const StoreLockGuard&) = delete;
+    StoreLockGuard& operator=(const StoreLockGuard&) = delete;
+
+    bool owns_lock() const { return owns; }
+};
+
+#endif // HEARTY_STORE_LOCK_MANAGER_HPP
@@ -0,0 +1,897 @@
+/**
+ * @file hearty-store-log-engine.cpp
+ * @author Nathadon Samairat
+ * @brief Appending, replaying and compacting the segments of log-structured stores.
+ * @version 0.1
+ * @date 2024-12-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "hearty-store-log-engine.hpp"
+#include "hearty-store-crc32c.hpp"
+
+// Number of block checksums in the record of an object of data_size bytes
+static uint64_t blockCount(uint64_t data_size) {
+    return (data_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Helper function to extend the block checksums of a content by its next
+// bytes, written bytes of it came before
+static void checksumBlocks(std::vector<uint32_t>& checksums, uint64_t written, const char* data, size_t size) {
+    while (size > 0) {
+        uint64_t block = written / BLOCK_SIZE;
+        size_t n = std::min<uint64_t>(size, BLOCK_SIZE - written % BLOCK_SIZE);
+        if (checksums.size() <= block) {
+            checksums.resize(block + 1, 0);
+        }
+        checksums[block] = crc32c(checksums[block], data, n);
+        data += n;
+        size -= n;
+        written += n;
+    }
+}
+
+// Helper function to compute the CRC of a record: the header after the crc
+// field, the id, the path and the block checksums
+static uint32_t headerCrc(const ObjectRecordHeader& header, std::string_view object_id,
+                          std::string_view file_path, const std::vector<uint32_t>& checksums) {
+    const size_t skip = offsetof(ObjectRecordHeader, type);
+    uint32_t crc = crc32c(0, reinterpret_cast<const char*>(&header) + skip, sizeof(header) - skip);
+    crc = crc32c(crc, object_id.data(), object_id.size());
+    crc = crc32c(crc, file_path.data(), file_path.size());
+    return crc32c(crc, reinterpret_cast<const char*>(checksums.data()), checksums.size() * sizeof(uint32_t));
+}
+
+// Helper function to check the blocks of a located object that hold bytes
+// [from, to) of it, each block whole, against the checksums of its record
+static bool checkBlocks(const std::string& object_id, const MappedObject& object, const char* content,
+                        uint64_t from, uint64_t to) {
+    if (from >= to) {
+        return true;
+    }
+    for (uint64_t block = from / BLOCK_SIZE; block * BLOCK_SIZE < to; block++) {
+        uint64_t start = block * BLOCK_SIZE;
+        uint64_t size = std::min<uint64_t>(BLOCK_SIZE, object.data_size - start);
+        if (crc32c(0, content + start, size) != object.checksums[block]) {
+            std::cerr << "Checksum mismatch in block " << block << " of object " << object_id << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Helper function to fill in the header of an OBJECT record, without its CRC
+static ObjectRecordHeader objectHeader(std::string_view object_id, std::string_view file_path,
+                                       uint64_t data_size, uint64_t sequence) {
+    ObjectRecordHeader header{};
+    header.magic = OBJECT_RECORD_MAGIC;
+    header.type = OBJECT_RECORD;
+    header.id_length = object_id.size();
+    header.path_length = file_path.size();
+    header.sequence = sequence;
+    header.data_size = data_size;
+    return header;
+}
+
+static ObjectRecordHeader commitHeader() {
+    ObjectRecordHeader header{};
+    header.magic = OBJECT_RECORD_MAGIC;
+    header.type = COMMIT_RECORD;
+    header.crc = headerCrc(header, {}, {}, {});
+    return header;
+}
+
+// Helper function to write a list of buffers in order at a fixed offset
+static bool pwritevAll(int fd, std::vector<struct iovec> buffers, off_t offset) {
+    size_t first = 0;
+    while (first < buffers.size()) {
+        if (buffers[first].iov_len == 0) {
+            first++;
+            continue;
+        }
+
+        int count = static_cast<int>(std::min<size_t>(buffers.size() - first, IOV_MAX));
+        ssize_t n = pwritev(fd, &buffers[first], count, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        offset += n;
+
+        // Skip the buffers that are written, trim the one the write stopped in
+        while (n > 0) {
+            size_t take = std::min<size_t>(n, buffers[first].iov_len);
+            buffers[first].iov_base = static_cast<char*>(buffers[first].iov_base) + take;
+            buffers[first].iov_len -= take;
+            n -= take;
+            if (buffers[first].iov_len == 0) {
+                first++;
+            }
+        }
+    }
+    return true;
+}
+
+static struct iovec bufferOf(const void* data, size_t size) {
+    return {const_cast<void*>(data), size};
+}
+
+// Helper function to make a created or removed segment file durable
+static void syncDirectory(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    fsync(fd);
+    ::close(fd);
+}
+
+ObjectSegment::~ObjectSegment() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+/**
+ * @brief Maps the segment read-only. The mapping reaches past the end of the
+ *        file up to the segment size, so the active segment is only mapped
+ *        again once it grows beyond that.
+ *
+ * @param end   - Bytes the mapping has to cover.
+ * @return The mapping, or null on failure.
+ */
+std::shared_ptr<const DataMapping> ObjectSegment::mapping(uint64_t end) {
+    std::lock_guard<std::mutex> guard(map_lock);
+    if (map && map->size() >= end) {
+        return map;
+    }
+
+    size_t length = std::max<uint64_t>(end, OBJECT_SEGMENT_SIZE);
+    void* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Failed to map segment " << number << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    // Views handed out earlier keep the old mapping
+    map = std::make_shared<DataMapping>(static_cast<char*>(addr), length);
+    return map;
+}
+
+// Creates the next segment file, it is not part of the store until it is added to segments
+std::shared_ptr<ObjectSegment> LogStructuredStore::createSegment() {
+    auto segment = std::make_shared<ObjectSegment>(next_segment++);
+    std::string path = utils::getSegmentPath(store_id, segment->number);
+    segment->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment->fd < 0) {
+        std::cerr << "Failed to create segment " << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    syncDirectory(utils::getStorePath(store_id));
+    return segment;
+}
+
+// Makes sure there is an active segment with room, write_lock must be held
+bool LogStructuredStore::startTransaction() {
+    if (active && active->size < OBJECT_SEGMENT_SIZE) {
+        return true;
+    }
+
+    // A sealed segment is synced once here, sync() only covers the active one
+    if (active && fdatasync(active->fd) != 0) {
+        std::cerr << "Failed to sync segment " << active->number << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::shared_ptr<ObjectSegment> segment = createSegment();
+    if (!segment) {
+        return false;
+    }
+    {
+        std::unique_lock<std::shared_mutex> indexing(index_lock);
+        segments[segment->number] = segment;
+    }
+    active = segment;
+    return true;
+}
+
+// Points the index at a committed object, index_lock must be held exclusively
+void LogStructuredStore::applyObject(const ObjectLocation& location) {
+    int entry = index.find(location.object_id);
+    if (entry != -1) {
+        // The same object again, copied by a compaction
+        ObjectLocation& current = objects[entry];
+        segments[current.segment]->live_bytes -= current.recordSize();
+        current = location;
+        segments[location.segment]->live_bytes += location.recordSize();
+        return;
+    }
+
+    // The object stored under the path before becomes garbage
+    auto it = paths.find(location.file_path);
+    if (it != paths.end()) {
+        ObjectLocation& old = objects[it->second];
+        if (old.sequence > location.sequence) {
+            // Replaced later already, only seen while replaying
+            return;
+        }
+        segments[old.segment]->live_bytes -= old.recordSize();
+        index.erase(old.object_id);
+        free_objects.push_back(it->second);
+        old = ObjectLocation{};
+        paths.erase(it);
+    }
+
+    if (free_objects.empty()) {
+        entry = objects.size();
+        objects.emplace_back();
+    } else {
+        entry = free_objects.back();
+        free_objects.pop_back();
+    }
+    objects[entry] = location;
+    index.insert(location.object_id, entry);
+    paths[location.file_path] = entry;
+    segments[location.segment]->live_bytes += location.recordSize();
+}
+
+// Scans a segment and indexes its committed objects, an unfinished tail is cut off
+bool LogStructuredStore::replaySegment(ObjectSegment& segment) {
+    struct stat st;
+    if (fstat(segment.fd, &st) != 0) {
+        std::cerr << "Failed to stat segment " << segment.number << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    uint64_t file_size = st.st_size;
+    if (file_size == 0) {
+        return true;
+    }
+    std::shared_ptr<const DataMapping> mapping = segment.mapping(file_size);
+    if (!mapping) {
+        return false;
+    }
+
+    // Records are only indexed once the COMMIT of their transaction is found
+    const char* data = mapping->data();
+    uint64_t position = 0;
+    uint64_t committed = 0;
+    std::vector<ObjectLocation> pending;
+    while (file_size - position >= sizeof(ObjectRecordHeader)) {
+        ObjectRecordHeader header;
+        memcpy(&header, data + position, sizeof(header));
+        if (header.magic != OBJECT_RECORD_MAGIC) {
+            break;
+        }
+        uint64_t left = file_size - position - sizeof(header);
+        uint64_t names = static_cast<uint64_t>(header.id_length) + header.path_length;
+        uint64_t content_size = header.type == OBJECT_RECORD ? header.data_size : 0;
+        uint64_t table = blockCount(content_size) * sizeof(uint32_t);
+        if (names > left || table > left - names || content_size > left - names - table) {
+            break;
+        }
+
+        // The blocks of the content are checked once here, a read checks only those it covers
+        const char* names_data = data + position + sizeof(header);
+        std::string_view object_id(names_data, header.id_length);
+        std::string_view file_path(names_data + header.id_length, header.path_length);
+        std::vector<uint32_t> checksums(blockCount(content_size));
+        memcpy(checksums.data(), names_data + names, table);
+        if (headerCrc(header, object_id, file_path, checksums) != header.crc) {
+            break;
+        }
+        const char* content = names_data + names + table;
+        std::vector<uint32_t> actual;
+        checksumBlocks(actual, 0, content, content_size);
+        if (actual != checksums) {
+            break;
+        }
+
+        uint64_t record_size = sizeof(header) + names + table + content_size;
+        if (header.type == OBJECT_RECORD) {
+            pending.push_back({segment.number, position, position + sizeof(header) + names + table,
+                               header.data_size, header.sequence, std::string(object_id), std::string(file_path)});
+            next_sequence = std::max(next_sequence, header.sequence + 1);
+        } else if (header.type == COMMIT_RECORD) {
+            for (const ObjectLocation& location : pending) {
+                applyObject(location);
+            }
+            pending.clear();
+            committed = position + record_size;
+        } else {
+            break;
+        }
+        position += record_size;
+    }
+
+    if (committed < file_size) {
+        // A Put that never committed, its records never took effect
+        std::cout << "Ignoring " << file_size - committed << " bytes of an unfinished Put in segment "
+                  << segment.number << " of store " << store_id << std::endl;
+        if (ftruncate(segment.fd, committed) != 0) {
+            std::cerr << "Failed to cut off segment " << segment.number << ": " << strerror(errno) << std::endl;
+        }
+    }
+    segment.size = committed;
+    return true;
+}
+
+/**
+ * @brief Opens the segments of a store and rebuilds its index from them.
+ *
+ * @param id    - ID of the store.
+ * @return true if every segment could be read; false otherwise
+ */
+bool LogStructuredStore::open(int id) {
+    store_id = id;
+
+    std::vector<uint64_t> numbers;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(utils::getStorePath(store_id), error)) {
+        uint64_t number;
+        if (utils::parseSegmentName("/" + entry.path().filename().string(), SEGMENT_PREFIX, SEGMENT_SUFFIX, number)) {
+            numbers.push_back(number);
+        }
+    }
+    if (error) {
+        std::cerr << "Failed to list the segments of store " << store_id << ": " << error.message() << std::endl;
+        return false;
+    }
+    std::sort(numbers.begin(), numbers.end());
+
+    // Later records of a path win, whatever segment a compaction moved them to
+    std::unique_lock<std::shared_mutex> indexing(index_lock);
+    for (uint64_t number : numbers) {
+        auto segment = std::make_shared<ObjectSegment>(number);
+        std::string path = utils::getSegmentPath(store_id, number);
+        segment->fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (segment->fd < 0) {
+            std::cerr << "Failed to open segment " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        segments[number] = segment;
+        if (!replaySegment(*segment)) {
+            return false;
+        }
+        next_segment = std::max<uint64_t>(next_segment, number + 1);
+    }
+
+    // New Puts go to a segment of their own, empty ones are dropped
+    for (auto it = segments.begin(); it != segments.end();) {
+        if (it->second->size == 0) {
+            unlink(utils::getSegmentPath(store_id, it->first).c_str());
+            it = segments.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return true;
+}
+
+bool LogStructuredStore::contains(const std::string& object_id) const {
+    std::shared_lock<std::shared_mutex> indexing(index_lock);
+    return index.find(object_id) != -1;
+}
+
+bool LogStructuredStore::size(const std::string& object_id, uint64_t& data_size) const {
+    std::shared_lock<std::shared_mutex> indexing(index_lock);
+    int entry = index.find(object_id);
+    if (entry == -1) {
+        return false;
+    }
+    data_size = objects[entry].data_size;
+    return true;
+}
+
+/**
+ * @brief Appends the records of the objects and a COMMIT to the active
+ *        segment with one vectored write, then indexes the objects. The
+ *        content is written from the caller's buffers as is.
+ *
+ * @param writes    - The objects, in order.
+ * @return true if the transaction was written; false otherwise
+ */
+bool LogStructuredStore::put(const std::vector<ObjectWrite>& writes) {
+    std::lock_guard<std::mutex> writing(write_lock);
+    if (!startTransaction()) {
+        return false;
+    }
+
+    std::vector<ObjectRecordHeader> headers(writes.size() + 1);
+    std::vector<std::vector<uint32_t>> computed(writes.size());
+    std::vector<ObjectLocation> locations;
+    std::vector<struct iovec> buffers;
+    uint64_t start = active->size;
+    uint64_t position = start;
+    for (size_t i = 0; i < writes.size(); i++) {
+        const ObjectWrite& write = writes[i];
+        if (!write.checksums) {
+            checksumBlocks(computed[i], 0, write.content.data(), write.content.size());
+        }
+        const std::vector<uint32_t>& checksums = write.checksums ? *write.checksums : computed[i];
+        ObjectRecordHeader& header = headers[i];
+        header = objectHeader(write.object_id, write.file_path, write.content.size(), next_sequence++);
+        header.crc = headerCrc(header, write.object_id, write.file_path, checksums);
+
+        buffers.push_back(bufferOf(&header, sizeof(header)));
+        buffers.push_back(bufferOf(write.object_id.data(), write.object_id.size()));
+        buffers.push_back(bufferOf(write.file_path.data(), write.file_path.size()));
+        buffers.push_back(bufferOf(checksums.data(), checksums.size() * sizeof(uint32_t)));
+        buffers.push_back(bufferOf(write.content.data(), write.content.size()));
+
+        uint64_t content = position + sizeof(header) + write.object_id.size() + write.file_path.size() +
+                           checksums.size() * sizeof(uint32_t);
+        locations.push_back({active->number, position, content, write.content.size(), header.sequence,
+                             std::string(write.object_id), std::string(write.file_path)});
+        position = content + write.content.size();
+    }
+    headers.back() = commitHeader();
+    buffers.push_back(bufferOf(&headers.back(), sizeof(ObjectRecordHeader)));
+    position += sizeof(ObjectRecordHeader);
+
+    if (!pwritevAll(active->fd, buffers, start)) {
+        std::cerr << "Failed to append to segment " << active->number << ": " << strerror(errno) << std::endl;
+        if (ftruncate(active->fd, start) != 0) {
+            std::cerr << "Failed to cut off segment " << active->number << std::endl;
+        }
+        return false;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> indexing(index_lock);
+        active->size = position;
+        for (const ObjectLocation& location : locations) {
+            applyObject(location);
+        }
+    }
+    appended += position - start;
+    return true;
+}
+
+/**
+ * @brief Starts a streamed Put. One of at least STREAM_SEGMENT_MIN bytes
+ *        gets a new segment of its own, where the id and the path are
+ *        written right away and the content follows as it arrives, after
+ *        room for its block checksums.
+ *
+ * @param object_id     - ID of the new object.
+ * @param file_path     - Path of the object.
+ * @param data_size     - Size of the whole object.
+ * @return The open put, or null if its segment could not be created.
+ */
+std::unique_ptr<ObjectStream> LogStructuredStore::begin(const std::string& object_id,
+                                                        const std::string& file_path, size_t data_size) {
+    auto stream = std::make_unique<OpenStream>(*this);
+    stream->object_id = object_id;
+    stream->file_path = file_path;
+    stream->data_size = data_size;
+    if (data_size < STREAM_SEGMENT_MIN) {
+        stream->buffer.reserve(data_size);
+        return stream;
+    }
+
+    stream->segment = createSegment();
+    if (!stream->segment) {
+        return nullptr;
+    }
+    stream->content = sizeof(ObjectRecordHeader) + object_id.size() + file_path.size() +
+                      blockCount(data_size) * sizeof(uint32_t);
+
+    std::vector<struct iovec> buffers{bufferOf(object_id.data(), object_id.size()),
+                                      bufferOf(file_path.data(), file_path.size())};
+    if (!pwritevAll(stream->segment->fd, buffers, sizeof(ObjectRecordHeader))) {
+        std::cerr << "Failed to write segment " << stream->segment->number << ": " << strerror(errno) << std::endl;
+        abort(*stream);
+        return nullptr;
+    }
+    return stream;
+}
+
+// Writes the next piece of a streamed Put, the last one is synced right away
+bool LogStructuredStore::append(OpenStream& stream, const char* data, size_t size) {
+    if (stream.written + size > stream.data_size) {
+        return false;
+    }
+    if (!stream.segment) {
+        stream.buffer.append(data, size);
+        checksumBlocks(stream.checksums, stream.written, data, size);
+        stream.written += size;
+        return true;
+    }
+
+    if (!pwritevAll(stream.segment->fd, {bufferOf(data, size)}, stream.content + stream.written)) {
+        std::cerr << "Failed to write segment " << stream.segment->number << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    checksumBlocks(stream.checksums, stream.written, data, size);
+    stream.written += size;
+
+    // The content goes to disk before the commit, so the commit only syncs its header and checksums
+    if (stream.written == stream.data_size && fdatasync(stream.segment->fd) != 0) {
+        std::cerr << "Failed to sync segment " << stream.segment->number << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Commits a streamed Put. The sequence is taken now, so the Put
+ *        replaces whatever was stored under its path by Puts committed while
+ *        it streamed. The header, the block checksums gathered along the
+ *        way and a COMMIT are written and synced, then the segment joins
+ *        the store, already sealed. A put gathered in memory is appended to
+ *        the active segment and made durable by sync().
+ *
+ * @param stream    - The put started by begin, with all of its content.
+ * @return true if the object is committed; false otherwise
+ */
+bool LogStructuredStore::commit(OpenStream& stream) {
+    if (stream.written != stream.data_size) {
+        return false;
+    }
+    if (!stream.segment) {
+        bool stored = put({{stream.object_id, stream.file_path, stream.buffer, &stream.checksums}});
+        stream.buffer = std::string();
+        return stored;
+    }
+
+    ObjectRecordHeader header;
+    {
+        std::lock_guard<std::mutex> writing(write_lock);
+        header = objectHeader(stream.object_id, stream.file_path, stream.data_size, next_sequence++);
+    }
+    header.crc = headerCrc(header, stream.object_id, stream.file_path, stream.checksums);
+
+    ObjectSegment& segment = *stream.segment;
+    uint64_t table = sizeof(header) + stream.object_id.size() + stream.file_path.size();
+    uint64_t end = stream.content + stream.data_size;
+    ObjectRecordHeader commit_header = commitHeader();
+    if (!pwritevAll(segment.fd, {bufferOf(&header, sizeof(header))}, 0) ||
+        !pwritevAll(segment.fd, {bufferOf(stream.checksums.data(), stream.checksums.size() * sizeof(uint32_t))},
+                    table) ||
+        !pwritevAll(segment.fd, {bufferOf(&commit_header, sizeof(commit_header))}, end) ||
+        fdatasync(segment.fd) != 0) {
+        std::cerr << "Failed to commit segment " << segment.number << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> indexing(index_lock);
+        segment.size = end + sizeof(commit_header);
+        segments[segment.number] = stream.segment;
+        applyObject({segment.number, 0, stream.content, stream.data_size, header.sequence,
+                     stream.object_id, stream.file_path});
+    }
+    stream.segment.reset();
+    return true;
+}
+
+// Drops a streamed Put that did not commit together with its segment
+void LogStructuredStore::abort(OpenStream& stream) {
+    stream.buffer = std::string();
+    if (!stream.segment) {
+        return;
+    }
+    if (unlink(utils::getSegmentPath(store_id, stream.segment->number).c_str()) != 0) {
+        std::cerr << "Failed to remove segment " << stream.segment->number << ": " << strerror(errno) << std::endl;
+    }
+    stream.segment.reset();
+}
+
+/**
+ * @brief Makes every committed Put durable. Concurrent callers share a
+ *        sync: the caller holding the sync lock syncs everything appended
+ *        so far, so those queued behind it find their records covered.
+ *
+ * @return true if everything committed so far is on disk; false otherwise
+ */
+bool LogStructuredStore::sync() {
+    uint64_t position;
+    {
+        std::lock_guard<std::mutex> writing(write_lock);
+        position = appended;
+    }
+
+    std::lock_guard<std::mutex> syncing(sync_lock);
+    if (durable >= position) {
+        return true;
+    }
+
+    // Sync everything appended by now, the Puts queued behind share it
+    std::shared_ptr<ObjectSegment> segment;
+    uint64_t target;
+    {
+        std::lock_guard<std::mutex> writing(write_lock);
+        segment = active;
+        target = appended;
+    }
+    // Segments sealed since were synced when they were sealed
+    if (segment && fdatasync(segment->fd) != 0) {
+        std::cerr << "Failed to sync segment " << segment->number << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    durable = target;
+    return true;
+}
+
+// Finds the bytes [offset, offset + length) of an object in the mapping of its
+// segment and takes the checksums of its blocks from the record. Only the
+// header, the names and the checksums are checked against the CRC of the
+// record here; the caller checks the blocks it reads with checkBlocks.
+bool LogStructuredStore::locate(const std::string& object_id, uint64_t offset, uint64_t length,
+                                MappedObject& object, const char*& content) const {
+    std::shared_ptr<ObjectSegment> segment;
+    uint64_t record;
+    uint64_t content_offset;
+    uint64_t data_size;
+    {
+        std::shared_lock<std::shared_mutex> indexing(index_lock);
+        int entry = index.find(object_id);
+        if (entry == -1) {
+            std::cerr << "Object not found: " << object_id << std::endl;
+            return false;
+        }
+        const ObjectLocation& location = objects[entry];
+        segment = segments.at(location.segment);
+        record = location.record;
+        content_offset = location.content;
+        data_size = location.data_size;
+    }
+
+    // Keep only the requested bytes, a length of 0 reads to the end
+    if (offset > data_size) {
+        std::cerr << "Offset " << offset << " is past the end of " << object_id << std::endl;
+        return false;
+    }
+    object.mapping = segment->mapping(content_offset + data_size);
+    if (!object.mapping) {
+        return false;
+    }
+
+    ObjectRecordHeader header;
+    memcpy(&header, object.mapping->data() + record, sizeof(header));
+    const char* names_data = object.mapping->data() + record + sizeof(header);
+    std::string_view id_view(names_data, header.id_length);
+    std::string_view path_view(names_data + header.id_length, header.path_length);
+    object.checksums.resize(blockCount(data_size));
+    memcpy(object.checksums.data(), names_data + id_view.size() + path_view.size(),
+           object.checksums.size() * sizeof(uint32_t));
+    if (headerCrc(header, id_view, path_view, object.checksums) != header.crc) {
+        std::cerr << "Checksum mismatch in the record of object " << object_id << std::endl;
+        return false;
+    }
+
+    content = object.mapping->data() + content_offset;
+    object.offset = offset;
+    object.end = utils::rangeEnd(offset, length, data_size);
+    object.data_size = data_size;
+    object.ranges.clear();
+    if (object.end > offset) {
+        object.ranges.emplace_back(content + offset, object.end - offset);
+    }
+    return true;
+}
+
+// Each block is checked whole before the first of its bytes goes out, so
+// nothing of a damaged block is sent. The next chunk is read in while the
+// current one is sent.
+bool LogStructuredStore::readChunks(const std::string& object_id, uint64_t offset, uint64_t length,
+                                    const StoreFiles::ChunkCallback& on_chunk) const {
+    MappedObject object;
+    const char* content;
+    if (!locate(object_id, offset, length, object, content)) {
+        return false;
+    }
+
+    uint64_t checked = offset;      // Bytes before this were checked
+    for (uint64_t position = offset; position < object.end;) {
+        if (position >= checked) {
+            if (!checkBlocks(object_id, object, content, position, position + 1)) {
+                return false;
+            }
+            checked = std::min<uint64_t>((position / BLOCK_SIZE + 1) * BLOCK_SIZE, object.data_size);
+        }
+        uint64_t n = std::min<uint64_t>({GET_CHUNK_SIZE, checked - position, object.end - position});
+        if (position + n < object.end) {
+            object.mapping->prefetch(content + position + n,
+                                     std::min<uint64_t>(object.end - position - n, GET_CHUNK_SIZE));
+        }
+        on_chunk(content + position, n);
+        position += n;
+    }
+    return true;
+}
+
+// The sender checks the blocks the range covers whole with checkMappedBlock
+// as it reaches them. Those at its edges, which it covers only partly, are
+// checked here from the mapping, so every block a read touches is checked.
+bool LogStructuredStore::readMapped(const std::string& object_id, uint64_t offset, uint64_t length,
+                                    MappedObject& object) const {
+    const char* content;
+    if (!locate(object_id, offset, length, object, content)) {
+        return false;
+    }
+    uint64_t first_whole = std::min<uint64_t>((offset + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE, object.end);
+    uint64_t last_whole = object.end == object.data_size ? object.end
+                                                         : std::max(first_whole, object.end / BLOCK_SIZE * BLOCK_SIZE);
+    return checkBlocks(object_id, object, content, offset, first_whole) &&
+           checkBlocks(object_id, object, content, last_whole, object.end);
+}
+
+bool LogStructuredStore::readBatch(const std::vector<std::string>& object_ids,
+                                   std::vector<std::string>& contents, std::vector<bool>& found) const {
+    contents.assign(object_ids.size(), "");
+    found.assign(object_ids.size(), false);
+    for (size_t i = 0; i < object_ids.size(); i++) {
+        MappedObject object;
+        const char* content;
+        if (locate(object_ids[i], 0, 0, object, content) &&
+            checkBlocks(object_ids[i], object, content, 0, object.data_size)) {
+            contents[i].assign(content, object.data_size);
+            found[i] = true;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Compacts the sealed segments whose live records make up less than
+ *        COMPACTION_LIVE_RATIO of them. Their live records are copied as
+ *        they are, CRC included, to new segments, each followed by a COMMIT.
+ *        Once the copies are durable the index is pointed at them, unless a
+ *        Put replaced the object meanwhile, and the old segments are
+ *        deleted. Gets still reading an old segment keep it mapped.
+ *
+ * @return true if the compaction finished or there was nothing to do; false otherwise
+ */
+bool LogStructuredStore::compact() {
+    std::unique_lock<std::mutex> compacting(compact_lock, std::try_to_lock);
+    if (!compacting.owns_lock()) {
+        return true;
+    }
+
+    // Segments created from now on are written to, they are left alone
+    uint64_t active_number = 0;
+    uint64_t first_new;
+    {
+        std::lock_guard<std::mutex> writing(write_lock);
+        if (active) {
+            active_number = active->number;
+        }
+        first_new = next_segment;
+    }
+
+    std::map<uint64_t, std::shared_ptr<ObjectSegment>> victims;
+    std::vector<ObjectLocation> moves;
+    uint64_t victim_bytes = 0;
+    {
+        std::shared_lock<std::shared_mutex> indexing(index_lock);
+        for (const auto& [number, segment] : segments) {
+            if (number == active_number || number >= first_new ||
+                segment->live_bytes >= segment->size * COMPACTION_LIVE_RATIO) {
+                continue;
+            }
+            victims[number] = segment;
+            victim_bytes += segment->size;
+        }
+        if (victims.empty()) {
+            return true;
+        }
+        for (const ObjectLocation& location : objects) {
+            if (!location.object_id.empty() && victims.count(location.segment)) {
+                moves.push_back(location);
+            }
+        }
+    }
+    std::sort(moves.begin(), moves.end(), [](const ObjectLocation& a, const ObjectLocation& b) {
+        return a.segment != b.segment ? a.segment < b.segment : a.record < b.record;
+    });
+
+    // Copy the live records, the victims are sealed and never change
+    std::vector<std::shared_ptr<ObjectSegment>> outputs;
+    std::vector<ObjectLocation> moved;
+    ObjectRecordHeader commit_header = commitHeader();
+    bool copied = true;
+    for (const ObjectLocation& from : moves) {
+        if (outputs.empty() || outputs.back()->size >= OBJECT_SEGMENT_SIZE) {
+            std::shared_ptr<ObjectSegment> output = createSegment();
+            if (!output) {
+                copied = false;
+                break;
+            }
+            outputs.push_back(output);
+        }
+        ObjectSegment& output = *outputs.back();
+        std::shared_ptr<const DataMapping> mapping = victims[from.segment]->mapping(from.record + from.recordSize());
+        if (!mapping || !pwritevAll(output.fd, {bufferOf(mapping->data() + from.record, from.recordSize()),
+                                                bufferOf(&commit_header, sizeof(commit_header))}, output.size)) {
+            std::cerr << "Failed to copy " << from.object_id << " out of segment " << from.segment << std::endl;
+            copied = false;
+            break;
+        }
+
+        ObjectLocation to = from;
+        to.segment = output.number;
+        to.record = output.size;
+        to.content = output.size + (from.content - from.record);
+        moved.push_back(to);
+        output.size += from.recordSize() + sizeof(commit_header);
+    }
+    for (const auto& output : outputs) {
+        if (copied && fdatasync(output->fd) != 0) {
+            std::cerr << "Failed to sync segment " << output->number << ": " << strerror(errno) << std::endl;
+            copied = false;
+        }
+    }
+    if (!copied) {
+        for (const auto& output : outputs) {
+            unlink(utils::getSegmentPath(store_id, output->number).c_str());
+        }
+        return false;
+    }
+
+    // The copies are durable, switch the index over and drop the victims
+    uint64_t output_bytes = 0;
+    {
+        std::unique_lock<std::shared_mutex> indexing(index_lock);
+        for (const auto& output : outputs) {
+            segments[output->number] = output;
+            output_bytes += output->size;
+        }
+        for (size_t i = 0; i < moves.size(); i++) {
+            int entry = index.find(moves[i].object_id);
+            if (entry == -1 || objects[entry].segment != moves[i].segment ||
+                objects[entry].record != moves[i].record) {
+                // Replaced meanwhile, the copy is garbage already
+                continue;
+            }
+            segments[moves[i].segment]->live_bytes -= moves[i].recordSize();
+            objects[entry] = moved[i];
+            segments[moved[i].segment]->live_bytes += moved[i].recordSize();
+        }
+        for (const auto& victim : victims) {
+            segments.erase(victim.first);
+        }
+    }
+    for (const auto& victim : victims) {
+        unlink(utils::getSegmentPath(store_id, victim.first).c_str());
+    }
+    syncDirectory(utils::getStorePath(store_id));
+
+    std::cout << "Compacted " << victims.size() << " segments of store " << store_id << ": moved "
+              << moved.size() << " objects, reclaimed "
+              << (victim_bytes > output_bytes ? victim_bytes - output_bytes : 0) << " bytes" << std::endl;
+    return true;
+}
+
+std::string LogStructuredStore::describe() const {
+    std::shared_lock<std::shared_mutex> indexing(index_lock);
+    uint64_t total = 0;
+    uint64_t live = 0;
+    for (const auto& entry : segments) {
+        total += entry.second->size;
+        live += entry.second->live_bytes;
+    }
+
+    std::ostringstream output;
+    output << std::fixed << std::setprecision(1) << "log-structured, "
+           << objects.size() - free_objects.size() << " objects, live: "
+           << live / (1024.0 * 1024.0) << "/" << total / (1024.0 * 1024.0) << " MB in "
+           << segments.size() << " segments";
+    return output.str();
+}
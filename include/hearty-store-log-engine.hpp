@@ -0,0 +1,198 @@
+/**
+ * @file hearty-store-log-engine.hpp
+ * @author Nathadon Samairat
+ * @brief Log-structured storage engine, chosen per store at Init. Objects
+ *        are appended to segment files in the store directory and found
+ *        through an in-memory index, so a Put is one sequential write that
+ *        never touches earlier data. A replaced object stays behind in its
+ *        segment as garbage until compaction copies the live objects out of
+ *        mostly dead segments and deletes them. The index is rebuilt at load
+ *        by scanning the segments.
+ * @version 0.1
+ * @date 2024-12-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_LOG_ENGINE_HPP
+#define HEARTY_STORE_LOG_ENGINE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "hearty-store-server.hpp"
+#include "hearty-store-files.hpp"
+#include "hearty-store-engine.hpp"
+#include "hearty-store-object-index.hpp"
+
+const uint32_t OBJECT_RECORD_MAGIC = 0x4A424F48;        // "HOBJ" on disk
+const size_t OBJECT_SEGMENT_SIZE = 64 * 1024 * 1024;    // A segment is sealed once it grows past this
+const double COMPACTION_LIVE_RATIO = 0.5;               // Sealed segments less live than this are compacted
+const size_t STREAM_SEGMENT_MIN = 4 * 1024 * 1024;      // Streamed Puts this large get a segment of their own
+
+struct ObjectRecordHeader {
+    uint32_t magic;
+    uint32_t crc;           // CRC32C of the rest of the header, the id, the path and the block checksums
+    uint32_t type;          // An ObjectRecordType
+    uint32_t id_length;
+    uint32_t path_length;
+    uint32_t reserved;
+    uint64_t sequence;      // Order of the Puts, kept when compaction moves an object
+    uint64_t data_size;
+};
+
+// An OBJECT record is followed by its id, its path, the CRC32C of each
+// BLOCK_SIZE block of its content and the content, so a read checks only the
+// blocks it covers. The OBJECT records up to the next COMMIT record, which has
+// no payload, are one transaction.
+enum ObjectRecordType : uint32_t {
+    OBJECT_RECORD = 1,
+    COMMIT_RECORD = 2
+};
+
+/**
+ * @brief A segment file. Only the active segment, compaction outputs and
+ *        the segments of open streamed Puts are written; the others are
+ *        sealed and only read, through a shared read-only mapping.
+ */
+class ObjectSegment {
+private:
+    std::mutex map_lock;
+    std::shared_ptr<const DataMapping> map;
+
+public:
+    uint64_t number;
+    int fd = -1;
+    std::atomic<uint64_t> size{0};  // Bytes of committed records
+    uint64_t live_bytes = 0;        // Bytes of records the index points to, guarded by the index lock
+
+    explicit ObjectSegment(uint64_t number) : number(number) {}
+    ~ObjectSegment();
+
+    ObjectSegment(const ObjectSegment&) = delete;
+    ObjectSegment& operator=(const ObjectSegment&) = delete;
+
+    // Returns a mapping covering at least the first end bytes, null on failure
+    std::shared_ptr<const DataMapping> mapping(uint64_t end);
+};
+
+class LogStructuredStore : public StorageEngine {
+private:
+    // Where an object's record lies
+    struct ObjectLocation {
+        uint64_t segment;
+        uint64_t record;        // Offset of the record header
+        uint64_t content;       // Offset of the content, after the block checksums
+        uint64_t data_size;
+        uint64_t sequence;
+        std::string object_id;
+        std::string file_path;
+
+        uint64_t recordSize() const { return content - record + data_size; }
+    };
+
+    int store_id = -1;
+
+    mutable std::shared_mutex index_lock;   // Guards the segments, the objects and their indexes
+    std::map<uint64_t, std::shared_ptr<ObjectSegment>> segments;
+    std::vector<ObjectLocation> objects;
+    std::vector<int> free_objects;          // Unused entries of objects
+    ObjectIndex index;                      // object_id -> entry of objects
+    std::unordered_map<std::string, int> paths;     // file_path -> entry, for overwrites
+
+    std::mutex write_lock;                  // Guards appends to the active segment
+    std::shared_ptr<ObjectSegment> active;  // Created on the first Put
+    std::atomic<uint64_t> next_segment{1};
+    uint64_t next_sequence = 1;
+    uint64_t appended = 0;                  // Bytes committed to active segments so far
+
+    std::mutex sync_lock;
+    uint64_t durable = 0;                   // Everything appended before this is on disk
+
+    std::mutex compact_lock;                // One compaction at a time
+
+    std::shared_ptr<ObjectSegment> createSegment();
+    bool startTransaction();
+    void applyObject(const ObjectLocation& location);
+    bool locate(const std::string& object_id, uint64_t offset, uint64_t length,
+                MappedObject& object, const char*& content) const;
+    bool replaySegment(ObjectSegment& segment);
+
+    /**
+     * @brief A streamed Put. A large one is written to a segment of its own,
+     *        so Puts to the active segment go on while its pieces arrive; the
+     *        segment joins the store at commit. The header, which carries
+     *        the sequence and the CRC, and the block checksums after the
+     *        names are only written then. A small one is gathered in memory
+     *        and appended like any Put at commit.
+     */
+    class OpenStream : public ObjectStream {
+    public:
+        LogStructuredStore& store;
+        std::shared_ptr<ObjectSegment> segment;     // Null for a put gathered in memory
+        std::string buffer;                         // Content of a put gathered in memory
+        std::string object_id;
+        std::string file_path;
+        uint64_t data_size = 0;
+        uint64_t written = 0;
+        uint64_t content = 0;                       // Offset of the content in its segment
+        std::vector<uint32_t> checksums;            // CRC32C of each block of the content written so far
+
+        explicit OpenStream(LogStructuredStore& store) : store(store) {}
+
+        bool append(const char* data, size_t size) override { return store.append(*this, data, size); }
+        bool commit() override { return store.commit(*this); }
+        void abort() override { store.abort(*this); }
+    };
+
+    bool append(OpenStream& stream, const char* data, size_t size);
+    bool commit(OpenStream& stream);
+    void abort(OpenStream& stream);
+
+public:
+    LogStructuredStore() = default;
+
+    LogStructuredStore(const LogStructuredStore&) = delete;
+    LogStructuredStore& operator=(const LogStructuredStore&) = delete;
+
+    // Scans the segments of a store and rebuilds the index
+    bool open(int store_id);
+
+    bool contains(const std::string& object_id) const override;
+    bool size(const std::string& object_id, uint64_t& data_size) const override;
+
+    // Appends the objects and a COMMIT as one transaction
+    bool put(const std::vector<ObjectWrite>& writes) override;
+
+    // Any number of streamed Puts can be open at once
+    std::unique_ptr<ObjectStream> begin(const std::string& object_id, const std::string& file_path,
+                                        size_t data_size) override;
+
+    bool sync() override;
+
+    bool readChunks(const std::string& object_id, uint64_t offset, uint64_t length,
+                    const StoreFiles::ChunkCallback& on_chunk) const override;
+    bool readMapped(const std::string& object_id, uint64_t offset, uint64_t length,
+                    MappedObject& object) const override;
+    bool readBatch(const std::vector<std::string>& object_ids,
+                   std::vector<std::string>& contents, std::vector<bool>& found) const override;
+
+    // Compacts the store
+    void maintain() override { compact(); }
+
+    // Copies the live objects out of sealed segments that are mostly garbage
+    // and deletes those segments. Runs next to Puts and Gets.
+    bool compact();
+
+    std::string describe() const override;
+};
+
+#endif // HEARTY_STORE_LOG_ENGINE_HPP
@@ -0,0 +1,167 @@
+/**
+ * @file hearty-store-object-index.hpp
+ * @author Nathadon Samairat
+ * @brief Open addressing hash index from object id to block index.
+ *        Laid out like a Swiss table: a byte of control metadata per slot
+ *        (empty, deleted, or 7 bits of the hash) is probed before any key
+ *        is compared, so a lookup usually touches a single key.
+ * @version 0.1
+ * @date 2024-12-08
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_OBJECT_INDEX_HPP
+#define HEARTY_STORE_OBJECT_INDEX_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+class ObjectIndex {
+private:
+    static constexpr uint8_t EMPTY = 0x80;      // Slot never used
+    static constexpr uint8_t DELETED = 0xFE;    // Slot freed by erase, keeps probing going
+    static constexpr size_t KEY_SIZE = 32;      // Same as BlockMetadata::object_id
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    struct Slot {
+        char key[KEY_SIZE];
+        int block;
+    };
+
+    std::vector<uint8_t> control;   // EMPTY, DELETED or the low 7 hash bits of a full slot
+    std::vector<Slot> slots;
+    size_t count = 0;               // Full slots
+    size_t tombstones = 0;          // DELETED slots
+
+    static size_t hashOf(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    // Keys are stored NUL padded, so the byte after the key must be the padding
+    static bool keyEquals(const Slot& slot, std::string_view key) {
+        return memcmp(slot.key, key.data(), key.size()) == 0 && slot.key[key.size()] == '\0';
+    }
+
+    // Object ids longer than BlockMetadata::object_id holds are truncated there too
+    static std::string_view trim(std::string_view key) {
+        return key.substr(0, std::min(key.size(), KEY_SIZE - 1));
+    }
+
+    // Returns the slot holding key, or -1
+    long findSlot(std::string_view key) const {
+        if (slots.empty()) {
+            return -1;
+        }
+        size_t hash = hashOf(key);
+        uint8_t fragment = hash & 0x7F;
+        size_t mask = slots.size() - 1;
+        for (size_t i = (hash >> 7) & mask; ; i = (i + 1) & mask) {
+            if (control[i] == EMPTY) {
+                return -1;
+            }
+            if (control[i] == fragment && keyEquals(slots[i], key)) {
+                return i;
+            }
+        }
+    }
+
+    // Rebuilds the table with the given capacity, dropping tombstones
+    void rehash(size_t capacity) {
+        std::vector<uint8_t> old_control = std::move(control);
+        std::vector<Slot> old_slots = std::move(slots);
+        control.assign(capacity, EMPTY);
+        slots.assign(capacity, Slot{});
+        count = 0;
+        tombstones = 0;
+        for (size_t i = 0; i < old_slots.size(); i++) {
+            if (!(old_control[i] & 0x80)) {
+                insert(old_slots[i].key, old_slots[i].block);
+            }
+        }
+    }
+
+public:
+    ObjectIndex() = default;
+    explicit ObjectIndex(size_t expected) { reserve(expected); }
+
+    // Sizes the table so that expected keys stay under 7/8 load
+    void reserve(size_t expected) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity * 7 / 8 <= expected) {
+            capacity *= 2;
+        }
+        if (capacity > slots.size()) {
+            rehash(capacity);
+        }
+    }
+
+    /**
+     * @brief Maps key to block, replacing any previous mapping of key.
+     */
+    void insert(std::string_view key, int block) {
+        key = trim(key);
+        if ((count + tombstones + 1) * 8 > slots.size() * 7) {
+            // Grow when mostly full, otherwise just clear out the tombstones
+            rehash(count * 2 >= slots.size() ? std::max(slots.size() * 2, MIN_CAPACITY)
+                                             : slots.size());
+        }
+
+        long existing = findSlot(key);
+        if (existing >= 0) {
+            slots[existing].block = block;
+            return;
+        }
+
+        size_t hash = hashOf(key);
+        size_t mask = slots.size() - 1;
+        size_t i = (hash >> 7) & mask;
+        while (!(control[i] & 0x80)) {
+            i = (i + 1) & mask;
+        }
+        if (control[i] == DELETED) {
+            tombstones--;
+        }
+        control[i] = hash & 0x7F;
+        memset(slots[i].key, 0, KEY_SIZE);
+        memcpy(slots[i].key, key.data(), key.size());
+        slots[i].block = block;
+        count++;
+    }
+
+    /**
+     * @brief Returns the block of key, or -1 if the key is not indexed.
+     */
+    int find(std::string_view key) const {
+        long slot = findSlot(trim(key));
+        return slot < 0 ? -1 : slots[slot].block;
+    }
+
+    /**
+     * @brief Removes key from the index. Returns whether it was present.
+     */
+    bool erase(std::string_view key) {
+        long slot = findSlot(trim(key));
+        if (slot < 0) {
+            return false;
+        }
+        control[slot] = DELETED;
+        count--;
+        tombstones++;
+        return true;
+    }
+
+    void clear() {
+        control.assign(control.size(), EMPTY);
+        count = 0;
+        tombstones = 0;
+    }
+
+    size_t size() const { return count; }
+};
+
+#endif // HEARTY_STORE_OBJECT_INDEX_HPP
@@ -10,30 +10,45 @@
  * 
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <filesystem>
 #include <vector>
 #include <random>
 #include <chrono>
 #include <cstring>
+#include <mutex>
+#include <atomic>
 #include "hearty-store-server.hpp"
-#include <openssl/md5.h>
-#include <sstream>
+#include "hearty-store-registry.hpp"
+#include "hearty-store-wal.hpp"
+#include "hearty-store-crc32c.hpp"
+
+// Serializes rollbacks of failed Puts
+static std::mutex recovery_lock;
 
 /**
  * @brief Generates a unique ID by combining a timestamp and a random number.
+ *        The timestamps handed out only grow, so no two IDs of one server
+ *        run are the same; the buffer pool relies on that.
  * 
  * @return std::string A unique identifier string in the format "timestamp_randomNumber".
  *         Example: "1637359000000_1234".
  */
 std::string generateUniqueId() {
     // Generate a random ID using timestamp and random number
-    auto now = std::chrono::system_clock::now();
-    auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch()
+    static std::atomic<int64_t> last_timestamp{0};
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
     ).count();
+    int64_t previous = last_timestamp.load();
+    int64_t timestamp;
+    do {
+        timestamp = std::max(now, previous + 1);
+    } while (!last_timestamp.compare_exchange_weak(previous, timestamp));
     std::random_device rd;      // Random device
     std::mt19937 gen(rd());     // RNG initialized with the seed from 'rd'
     // Generate random integers between 1000 and 9999 (inclusive)
@@ -42,297 +57,711 @@ std::string generateUniqueId() {
     return std::to_string(timestamp) + "_" + std::to_string(dis(gen));
 }
 
-std::string calculateMD5(const std::string& data) {
-    unsigned char result[MD5_DIGEST_LENGTH];
-    MD5((unsigned char*)data.c_str(), data.length(), result);
-    
-    std::stringstream ss;
-    for(int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)result[i];
+// Helper function to pick the ID of a new object that no object of the store
+// has. An ID stored before a restart can come up again if the clock went back.
+static std::string newObjectId(const StorageEngine& engine) {
+    std::string object_id = generateUniqueId();
+    while (engine.contains(object_id)) {
+        object_id = generateUniqueId();
     }
-    return ss.str();
+    return object_id;
 }
 
-void writeLogEntry(int store_id, const LogEntry& entry) {
-    std::ofstream log_file(utils::getLogPath(store_id), std::ios::app);
-    // Write log entry details based on type
-    log_file << static_cast<int>(entry.type) << "|";
-    switch(entry.type) {
-        case LogEntry::ALLOCATE:
-            log_file << entry.block_index << "\n";
-            break;
-        case LogEntry::PUT_FILE:
-            log_file << entry.block_index << "|" << entry.checksum << "|" 
-                    << entry.old_block_data << "\n";
-            break;
-        case LogEntry::ADD_ENTRY:
-            log_file << entry.object_id << "|" << entry.block_index << "|" 
-                    << entry.data_size << "|" << entry.file_path << "\n";
-            break;
-        case LogEntry::COMMIT:
-            log_file << "COMMIT\n";
-            break;
+uint64_t writeLogEntry(int store_id, const LogEntry& entry) {
+    // Buffered by the store's group commit log until a sync writes it out
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to log to store " << store_id << std::endl;
+        return 0;
     }
-    log_file.flush();
+    return store->log.append(entry);
 }
 
-// Helper function to allocate a block
-int allocateBlock(int store_id, const std::string& file_path, std::vector<BlockMetadata>& block_metadata) {
-    int block_num = -1;
-    for (size_t i = 0; i < NUM_BLOCKS; i++) {
-        if (!block_metadata[i].is_used) {
-            block_num = i;
-            break;
+/**
+ * @brief Waits until everything logged to a store so far is on disk. Callers
+ *        do this after unlocking the store, so the commits of concurrent
+ *        Puts share one fdatasync.
+ *
+ * @param store_id  - ID of the store.
+ * @return true if the log and the files are durable; false otherwise
+ */
+bool syncLog(int store_id) {
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    return store && store->engine->sync();
+}
+
+// Helper function to find where an existing object is stored
+Placement placementOf(const StoreState& store, int record) {
+    const BlockMetadata& block = store.blocks[record];
+    Placement placement;
+    placement.record = record;
+    placement.size_class = block.size_class;
+    placement.offset = block.offset;
+    if (block.size_class == 0) {
+        placement.extents = objectExtents(store, record);
+    }
+    return placement;
+}
+
+// Helper function to give the space of an object back, dropping a slab once it is empty
+void releasePlacement(StoreState& store, const Placement& placement) {
+    if (placement.size_class == 0) {
+        for (const Extent& extent : placement.extents) {
+            for (int b = 0; b < extent.num_blocks; b++) {
+                store.bitmap.clear(extent.start_block + b);
+            }
         }
-        else if (block_metadata[i].file_path == file_path) {
-            block_num = i;
-            break;
+        return;
+    }
+
+    int block_num = placement.offset / BLOCK_SIZE;
+    auto it = store.slabs.find(block_num);
+    if (it != store.slabs.end()) {
+        Slab& slab = it->second;
+        std::set<int>& open = store.open_slabs[slab.size_class - 1];
+        slab.slots.clear((placement.offset % BLOCK_SIZE) / utils::slotSize(slab.size_class));
+        if (slab.slots.count() == 0) {
+            store.bitmap.clear(block_num);
+            open.erase(block_num);
+            store.slabs.erase(it);
+        } else {
+            open.insert(block_num);
         }
     }
+    store.slab_records.clear(placement.record - store.metadata.total_blocks);
+}
 
-    if (block_num != -1) {
-        // Log block allocation
-        LogEntry allocate_entry{LogEntry::ALLOCATE, block_num};
-        writeLogEntry(store_id, allocate_entry);
-        
-        // Update block allocation in metadata
-        block_metadata[block_num].is_used = true;
+// Helper function to free the space of a replaced object once its
+// replacement is durable. Until then a crash can bring the old object back,
+// so no other Put may write over it.
+void retirePlacement(StoreState& store, const Placement& placement, uint64_t commit_position) {
+    if (placement.record != -1) {
+        store.retired.push_back({commit_position, placement});
+    }
+}
+
+// Helper function to free retired space whose commit is on disk, waiting for
+// a sync first if asked to. Space a Get is still sending from stays retired.
+// Returns whether anything was freed.
+bool reclaimRetired(StoreState& store, bool wait_for_sync) {
+    if (store.retired.empty()) {
+        return false;
+    }
+    if (wait_for_sync) {
+        store.log.sync(store.retired.back().commit_position);
     }
 
-    return block_num;
+    uint64_t durable = store.log.durablePosition();
+    size_t freed = 0;
+    std::vector<RetiredPlacement> kept;
+    for (RetiredPlacement& retired : store.retired) {
+        if (retired.commit_position > durable || store.pins->pinned(retired.placement.record)) {
+            kept.push_back(std::move(retired));
+            continue;
+        }
+        releasePlacement(store, retired.placement);
+        freed++;
+    }
+    store.retired.swap(kept);
+    store.metadata.used_blocks = store.bitmap.count();
+    return freed > 0;
 }
 
-// Helper function to write content to a block
-bool putContentToBlock(int store_id, int block_num, const std::string& file_content) {
-    if (file_content.size() > BLOCK_SIZE) {
-        std::cerr << "File too large (max 1MB)" << std::endl;
+// Helper function to find a free slot of a size class, carving a new slab out of a free block if needed
+bool allocateSlot(int store_id, int size_class, StoreState& store, Placement& placement) {
+    long record = store.slab_records.allocate();
+    if (record == -1 && growSlabRecords(store)) {
+        record = store.slab_records.allocate();
+    }
+    if (record == -1) {
+        std::cerr << "No free slab records" << std::endl;
         return false;
     }
 
-    // Get old data for WAL
-    std::string old_data;
-    {
-        std::ifstream data_file(utils::getDataPath(store_id), std::ios::binary);
-        data_file.seekg(block_num * BLOCK_SIZE);
-        std::vector<char> buffer(BLOCK_SIZE);
-        data_file.read(buffer.data(), BLOCK_SIZE);
-        old_data = std::string(buffer.data(), BLOCK_SIZE);
+    // Prefer a slab of the same class that still has room
+    std::set<int>& open = store.open_slabs[size_class - 1];
+    int block_num = open.empty() ? -1 : *open.begin();
+    if (block_num == -1) {
+        long block = store.bitmap.allocate();
+        if (block == -1) {
+            store.slab_records.clear(record);
+            std::cerr << "No free blocks available" << std::endl;
+            return false;
+        }
+        block_num = block;
+        Slab& slab = store.slabs[block_num];
+        slab.size_class = size_class;
+        slab.slots.resize(BLOCK_SIZE / utils::slotSize(size_class));
+        open.insert(block_num);
     }
 
-    // Log file content update
-    LogEntry put_entry{
-        LogEntry::PUT_FILE,
-        block_num,
-        calculateMD5(file_content),
-        old_data
-    };
-    writeLogEntry(store_id, put_entry);
+    Slab& slab = store.slabs[block_num];
+    long slot = slab.slots.allocate();
+    if (slab.slots.count() == slab.slots.size()) {
+        open.erase(block_num);
+    }
+    placement.record = store.metadata.total_blocks + record;
+    placement.size_class = size_class;
+    placement.offset = block_num * BLOCK_SIZE + slot * utils::slotSize(size_class);
+
+    // Log slot allocation
+    LogEntry allocate_entry{.type = LogEntry::ALLOCATE, .block_index = placement.record};
+    writeLogEntry(store_id, allocate_entry);
+
+    return true;
+}
 
-    // Write actual file content
-    {
-        std::fstream data_file(utils::getDataPath(store_id), 
-                             std::ios::binary | std::ios::in | std::ios::out);
-        data_file.seekp(block_num * BLOCK_SIZE);
-        data_file << file_content;
+// Helper function to allocate the blocks of an object in as few contiguous runs as possible
+std::vector<Extent> allocateExtents(int store_id, size_t num_blocks, size_t hint, StoreState& store) {
+    std::vector<Extent> extents;
+    size_t remaining = num_blocks;
+    while (remaining > 0) {
+        size_t got = 0;
+        long start = store.bitmap.allocateRun(remaining, hint, got);
+        if (start == -1) {
+            // Not enough free space, give back the runs taken so far
+            for (const Extent& extent : extents) {
+                for (int b = 0; b < extent.num_blocks; b++) {
+                    store.bitmap.clear(extent.start_block + b);
+                }
+            }
+            return {};
+        }
+        extents.push_back({static_cast<int>(start), static_cast<int>(got)});
+        remaining -= got;
+        hint = start + got;
     }
 
+    // Log block allocation, one entry per run
+    for (const Extent& extent : extents) {
+        LogEntry allocate_entry{.type = LogEntry::ALLOCATE, .block_index = extent.start_block};
+        writeLogEntry(store_id, allocate_entry);
+    }
+
+    return extents;
+}
+
+// Helper function to allocate the space of a new object: a slab slot for a
+// small one, runs of blocks otherwise. If the store is full, waits for the
+// space of replaced objects to become free and tries once more.
+bool allocatePlacement(int store_id, size_t size, size_t hint, StoreState& store, Placement& placement) {
+    int size_class = utils::sizeClassOf(size);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (attempt == 1 && !reclaimRetired(store, true)) {
+            break;
+        }
+        if (size_class != 0) {
+            if (allocateSlot(store_id, size_class, store, placement)) {
+                return true;
+            }
+            continue;
+        }
+
+        size_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        placement.extents = allocateExtents(store_id, num_blocks, hint, store);
+        if (!placement.extents.empty()) {
+            placement.record = placement.extents.front().start_block;
+            return true;
+        }
+    }
+    if (size_class == 0) {
+        std::cerr << "Not enough free blocks for " << size << " bytes" << std::endl;
+    }
+    return false;
+}
+
+// Helper function to write content to the blocks of an object, run by run
+bool putContentToBlocks(const std::vector<Extent>& extents, std::string_view file_content,
+                        const StoreFiles& files) {
+    // The blocks are free space, nothing reaches them until the commit, so
+    // there is no old content to log
+    size_t offset = 0;
+    for (const Extent& extent : extents) {
+        size_t run_size = std::min(extent.num_blocks * BLOCK_SIZE, file_content.size() - offset);
+        if (!files.writeData(file_content.data() + offset, run_size,
+                             static_cast<off_t>(extent.start_block) * BLOCK_SIZE)) {
+            std::cerr << "Failed to write block data" << std::endl;
+            return false;
+        }
+        offset += run_size;
+    }
     return true;
 }
 
-// Helper function to update metadata
-bool updateMetadata(int store_id, int block_num, const std::string& object_id, 
-                   const std::string& file_path, uintmax_t file_size,
-                   StoreMetadata& store_metadata, std::vector<BlockMetadata>& block_metadata) {
+// Helper function to write content to a free slab slot
+bool putContentToSlot(size_t offset, std::string_view file_content, const StoreFiles& files) {
+    if (!files.writeData(file_content.data(), file_content.size(), offset)) {
+        std::cerr << "Failed to write slot data" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Helper function to extend the block checksums of a Put by the next bytes of
+// its content, written bytes of it came before. A slab slot has one checksum.
+void checksumContent(Placement& placement, size_t written, const char* data, size_t size) {
+    while (size > 0) {
+        size_t block = placement.size_class != 0 ? 0 : written / BLOCK_SIZE;
+        size_t n = placement.size_class != 0 ? size : std::min(size, BLOCK_SIZE - written % BLOCK_SIZE);
+        if (placement.checksums.size() <= block) {
+            placement.checksums.resize(block + 1, 0);
+        }
+        placement.checksums[block] = crc32c(placement.checksums[block], data, n);
+        data += n;
+        size -= n;
+        written += n;
+    }
+}
+
+// Helper function to update the resident metadata, collecting the records that changed
+void applyMetadata(int store_id, const Placement& placement, const Placement& old_placement,
+                   const std::string& object_id, const std::string& file_path,
+                   uintmax_t file_size, StoreState& store, std::vector<int>& changed_records) {
+    int head = placement.record;
+
+    // The records of the object stored under this path before are dropped.
+    // Their images go into the log, so a rollback brings the old object back.
+    std::vector<int> replaced;
+    if (old_placement.record != -1) {
+        replaced.push_back(old_placement.record);
+        for (const Extent& extent : old_placement.extents) {
+            if (extent.start_block != old_placement.record) {
+                replaced.push_back(extent.start_block);
+            }
+        }
+    }
+
     // Log metadata update
     LogEntry metadata_entry{
-        LogEntry::ADD_ENTRY,
-        block_num,
-        "",
-        "",
-        object_id,
-        file_size,
-        file_path
+        .type = LogEntry::ADD_ENTRY,
+        .block_index = head,
+        .object_id = object_id,
+        .data_size = file_size,
+        .file_path = file_path,
     };
+    for (int record : replaced) {
+        metadata_entry.replaced_records.emplace_back(record, store.blocks[record]);
+    }
     writeLogEntry(store_id, metadata_entry);
 
-    // Update metadata
-    strncpy(block_metadata[block_num].object_id, object_id.c_str(), 
-            sizeof(block_metadata[block_num].object_id) - 1);
-    block_metadata[block_num].data_size = file_size;
-    block_metadata[block_num].timestamp = std::time(nullptr);
-    strncpy(block_metadata[block_num].file_path, file_path.c_str(), 
-            sizeof(block_metadata[block_num].file_path) - 1);
-    store_metadata.used_blocks++;
-
-    // Save metadata
-    std::ofstream meta_file(utils::getMetadataPath(store_id), std::ios::binary);
-    if (!meta_file) {
-        return false;
+    std::vector<int> changed;
+    if (old_placement.record != -1) {
+        store.index.erase(store.blocks[old_placement.record].object_id);
+        store.paths.erase(file_path);
+        for (int record : replaced) {
+            store.blocks[record] = BlockMetadata{};
+            changed.push_back(record);
+        }
+    }
+
+    // Describe every run in the record of its first block. The records go out
+    // in file order with the rest of the transaction, so a crash may leave
+    // the head written before the rest of the chain; the rollback of the
+    // uncommitted ADD_ENTRY clears the head then. A slab object has its
+    // single record.
+    const std::vector<Extent>& extents = placement.extents;
+    for (size_t i = 0; i < extents.size(); i++) {
+        BlockMetadata& block = store.blocks[extents[i].start_block];
+        block = BlockMetadata{};
+        block.is_used = true;
+        block.extent_blocks = extents[i].num_blocks;
+        block.next_extent = i + 1 < extents.size() ? extents[i + 1].start_block : -1;
+        changed.push_back(extents[i].start_block);
+    }
+    if (placement.size_class != 0) {
+        BlockMetadata& block = store.blocks[head];
+        block = BlockMetadata{};
+        block.is_used = true;
+        block.size_class = placement.size_class;
+        block.offset = placement.offset;
+        changed.push_back(head);
     }
 
-    meta_file.write(reinterpret_cast<char*>(&store_metadata), sizeof(StoreMetadata));
-    for (const auto& block : block_metadata) {            
-        meta_file.write(reinterpret_cast<const char*>(&block), sizeof(BlockMetadata));
+    // Every data block keeps the checksum of its bytes in its own record,
+    // which is only in use at the start of a run
+    size_t checked = 0;
+    if (placement.size_class != 0) {
+        store.blocks[head].checksum = placement.checksums.empty() ? 0 : placement.checksums[0];
+    }
+    for (const Extent& extent : extents) {
+        for (int b = 0; b < extent.num_blocks && checked < placement.checksums.size(); b++, checked++) {
+            store.blocks[extent.start_block + b].checksum = placement.checksums[checked];
+            if (b > 0) {
+                changed.push_back(extent.start_block + b);
+            }
+        }
     }
-    meta_file.flush();
 
-    return !meta_file.fail();
+    BlockMetadata& block = store.blocks[head];
+    strncpy(block.object_id, object_id.c_str(), sizeof(block.object_id) - 1);
+    block.data_size = file_size;
+    block.timestamp = std::time(nullptr);
+    strncpy(block.file_path, file_path.c_str(), sizeof(block.file_path) - 1);
+    store.metadata.used_blocks = store.bitmap.count();
+    store.index.insert(block.object_id, head);
+    store.paths[block.file_path] = head;
+
+    changed_records.insert(changed_records.end(), changed.begin(), changed.end());
 }
 
-bool readStoreMetadata(int store_id, 
-                      StoreMetadata& store_metadata, 
-                      std::vector<BlockMetadata>& block_metadata) {
-    std::ifstream meta_file(utils::getMetadataPath(store_id), std::ios::binary);
-    std::ifstream data_file(utils::getDataPath(store_id), std::ios::binary);
-    
-    if (!meta_file) {
-        std::cerr << "Failed to open metadata file" << std::endl;
-        return false;
-    }
+// Helper function to update metadata
+bool updateMetadata(int store_id, const Placement& placement, const Placement& old_placement,
+                    const std::string& object_id, const std::string& file_path,
+                    uintmax_t file_size, StoreState& store) {
+    std::vector<int> changed;
+    applyMetadata(store_id, placement, old_placement, object_id, file_path, file_size, store, changed);
 
-    meta_file.read(reinterpret_cast<char*>(&store_metadata), sizeof(StoreMetadata));
-    
-    for (auto& block : block_metadata) {
-        data_file.read(reinterpret_cast<char*>(&block), sizeof(BlockMetadata));
-        if (data_file.fail()) {
-            std::cerr << "Failed to read block metadata" << std::endl;
+    // Only the changed records and the header go to disk
+    return saveBlockMetadata(store, changed);
+}
+
+// Rolls back the Put that just failed, it was logged but never committed
+void recoverFromLog(int store_id) {
+    std::lock_guard<std::mutex> lock(recovery_lock);
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) return;
+
+    replayLog(*store);
+}
+
+/**
+ * @brief Stores the objects in free space (copy-on-write), so the objects
+ *        they replace stay intact until the commit and only the record
+ *        updates, with images of the records they replace, are logged. Every object is written first, then all
+ *        metadata changes are applied and written through in one flush,
+ *        followed by one COMMIT. If anything fails none of the objects is
+ *        stored.
+ *
+ * @param writes    - The objects, in order.
+ * @return true if the objects are committed; false otherwise
+ */
+bool BlockEngine::put(const std::vector<ObjectWrite>& writes) {
+    int store_id = store.store_id;
+
+    // Space of objects replaced earlier is free once their commits are durable
+    reclaimRetired(store, false);
+
+    // 1. Allocate and write every object, nothing is visible yet. Small
+    //    objects share a slab of their size class, others get runs of
+    //    blocks, preferably a single one near the object they replace.
+    std::vector<Placement> placements(writes.size());
+    for (size_t i = 0; i < writes.size(); i++) {
+        const std::string_view& content = writes[i].content;
+        size_t hint = 0;
+        auto it = store.paths.find(std::string(writes[i].file_path));
+        if (it != store.paths.end() && store.blocks[it->second].size_class == 0) {
+            hint = it->second;
+        }
+
+        Placement& placement = placements[i];
+        bool stored = allocatePlacement(store_id, content.size(), hint, store, placement);
+        if (stored) {
+            checksumContent(placement, 0, content.data(), content.size());
+            stored = placement.size_class != 0
+                     ? putContentToSlot(placement.offset, content, store.files)
+                     : putContentToBlocks(placement.extents, content, store.files);
+        }
+
+        if (!stored) {
+            // Frees everything allocated so far right away instead of leaving it to the next request
+            recoverFromLog(store_id);
             return false;
         }
     }
-    
+
+    // 2. Apply the metadata of every object in order, so a later object
+    //    replaces an earlier one with the same path
+    std::vector<Placement> old_placements;
+    std::vector<int> changed;
+    for (size_t i = 0; i < writes.size(); i++) {
+        std::string file_path(writes[i].file_path);
+        Placement old_placement;
+        auto it = store.paths.find(file_path);
+        if (it != store.paths.end()) {
+            old_placement = placementOf(store, it->second);
+            old_placements.push_back(old_placement);
+        }
+        applyMetadata(store_id, placements[i], old_placement, std::string(writes[i].object_id), file_path,
+                      writes[i].content.size(), store, changed);
+    }
+
+    // 3. One metadata flush, the records go out in file order
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    if (!saveBlockMetadata(store, changed)) {
+        recoverFromLog(store_id);
+        return false;
+    }
+
+    // 4. Write commit log, made durable by the caller once the store is unlocked.
+    //    The space of the replaced objects is reused only after that.
+    LogEntry commit_entry{.type = LogEntry::COMMIT};
+    uint64_t commit_position = writeLogEntry(store_id, commit_entry);
+    for (const Placement& old_placement : old_placements) {
+        retirePlacement(store, old_placement, commit_position);
+    }
     return true;
 }
 
-void recoverFromLog(int store_id) {
-    std::ifstream log_file(utils::getLogPath(store_id));
-    if (!log_file) return;
+bool BlockEngine::sync() {
+    return store.log.sync();
+}
 
-    std::vector<LogEntry> uncommitted_entries;
-    bool found_commit = false;
-    std::string line;
-    
-    // Read log entries until we find last COMMIT
-    while (std::getline(log_file, line)) {
-        std::stringstream ss(line);
-        std::string token;
-        std::getline(ss, token, '|');
-        
-        int type = std::stoi(token);
-        if (type == LogEntry::COMMIT) {
-            found_commit = true;
-            uncommitted_entries.clear();
-            continue;
-        }
+/**
+ * @brief A streamed Put to a block store. The space of the whole object is
+ *        allocated up front from the announced size, so each piece is
+ *        written to its place on disk as soon as it arrives. Nothing else
+ *        reaches the allocated space, so the pieces are written and
+ *        checksummed without the store lock while other Puts and Gets go
+ *        on. The object stored under the path before stays intact until the
+ *        commit replaces it.
+ */
+class BlockStream : public ObjectStream {
+private:
+    StoreState& store;
+    std::string object_id;
+    std::string file_path;
+    size_t file_size;
+    size_t written = 0;             // Bytes of content written so far
+    Placement placement;
+    bool holds_space = true;        // Neither committed nor aborted yet
+
+public:
+    BlockStream(StoreState& store, const std::string& object_id, const std::string& file_path,
+                size_t file_size, const Placement& placement)
+        : store(store), object_id(object_id), file_path(file_path), file_size(file_size),
+          placement(placement) {}
+
+    bool append(const char* data, size_t size) override;
+    bool commit() override;
+    void abort() override;
+};
+
+std::unique_ptr<ObjectStream> BlockEngine::begin(const std::string& object_id, const std::string& file_path,
+                                                 size_t data_size) {
+    Placement placement;
+    reclaimRetired(store, false);
+    if (!allocatePlacement(store.store_id, data_size, 0, store, placement)) {
+        return nullptr;
+    }
+    // A rollback of another Put rebuilds the free space, it must not free this one
+    store.streaming[placement.record] = placement;
+    return std::make_unique<BlockStream>(store, object_id, file_path, data_size, placement);
+}
 
-        LogEntry entry;
-        entry.type = static_cast<LogEntry::LogType>(type);
-        
-        // Parse entry based on type
-        switch(entry.type) {
-            case LogEntry::ALLOCATE:
-                std::getline(ss, token);
-                entry.block_index = std::stoi(token);
-                break;
-            case LogEntry::PUT_FILE:
-                // Parse PUT_FILE entry
-                std::getline(ss, token, '|');
-                entry.block_index = std::stoi(token);
-                std::getline(ss, token, '|');
-                entry.checksum = token;
-                std::getline(ss, token);
-                entry.old_block_data = token;
-                break;
-            case LogEntry::ADD_ENTRY:
-                // Parse ADD_ENTRY entry
-                std::getline(ss, token, '|');
-                entry.object_id = token;
-                std::getline(ss, token, '|');
-                entry.block_index = std::stoi(token);
-                std::getline(ss, token, '|');
-                entry.data_size = std::stoul(token);
-                std::getline(ss, token);
-                entry.file_path = token;
-                break;
-            default:
-                break;
+// Writes the next piece to its place and extends the checksums of its blocks by it
+bool BlockStream::append(const char* data, size_t size) {
+    checksumContent(placement, written, data, size);
+    if (placement.size_class != 0) {
+        if (!store.files.writeData(data, size, placement.offset + written)) {
+            std::cerr << "Failed to write slot data" << std::endl;
+            return false;
         }
-        
-        uncommitted_entries.push_back(entry);
+        written += size;
+        return true;
     }
-    
-    // If we didn't find a commit, we need to rollback changes
-    std::cout << "Uncommitted entries: " << uncommitted_entries.size() << std::endl;
-    if (!uncommitted_entries.empty()) {
-        // Load metadata
-        StoreMetadata store_metadata{};
-        std::vector<BlockMetadata> block_metadata(NUM_BLOCKS);
-        for (auto it = uncommitted_entries.rbegin(); it != uncommitted_entries.rend(); ++it) {
-            // Rollback each operation
-            switch(it->type) {
-                case LogEntry::ALLOCATE:
-                    // Reset block allocation
-                    std::cout << "Allocating block for " << it->file_path << std::endl;
-                    allocateBlock(store_id, it->file_path, block_metadata);
-                    break;
-                case LogEntry::PUT_FILE:
-                    // Restore old block data
-                    std::cout << "Restoring old block data for " << it->file_path << std::endl;
-                    putContentToBlock(store_id, it->block_index, it->old_block_data);
-                    break;
-                case LogEntry::ADD_ENTRY:
-                    // Remove metadata entry
-                    std::cout << "Removing metadata entry for " << it->file_path << std::endl;
-                    updateMetadata(store_id, it->block_index, it->object_id, it->file_path,
-                                  0, store_metadata, block_metadata);
-                    break;
-                default:
-                    break;
+
+    // Split the piece where it crosses from one run into the next
+    size_t run_begin = 0;
+    for (const Extent& extent : placement.extents) {
+        size_t run_size = extent.num_blocks * BLOCK_SIZE;
+        while (size > 0 && written < run_begin + run_size) {
+            size_t in_run = written - run_begin;
+            size_t n = std::min(size, run_size - in_run);
+            if (!store.files.writeData(data, n, static_cast<off_t>(extent.start_block) * BLOCK_SIZE + in_run)) {
+                std::cerr << "Failed to write block data" << std::endl;
+                return false;
             }
+            data += n;
+            size -= n;
+            written += n;
         }
+        run_begin += run_size;
+    }
+    return true;
+}
 
-        LogEntry commit_entry{LogEntry::COMMIT};
-        writeLogEntry(store_id, commit_entry);
+// Points the records at the written space, replacing the object stored under the path before
+bool BlockStream::commit() {
+    Placement old_placement;
+    auto it = store.paths.find(file_path);
+    if (it != store.paths.end()) {
+        old_placement = placementOf(store, it->second);
     }
-    
-    // Clear log file after recovery
-    std::ofstream clear_log(utils::getLogPath(store_id), std::ios::trunc);
+
+    // From here on the records reach the space, or the rollback gives it back
+    holds_space = false;
+    store.streaming.erase(placement.record);
+    if (!updateMetadata(store.store_id, placement, old_placement, object_id, file_path, file_size, store)) {
+        recoverFromLog(store.store_id);
+        return false;
+    }
+
+    // Made durable by the caller once the store is unlocked, the old object's space is reused after that
+    LogEntry commit_entry{.type = LogEntry::COMMIT};
+    retirePlacement(store, old_placement, writeLogEntry(store.store_id, commit_entry));
+    return true;
+}
+
+void BlockStream::abort() {
+    if (!holds_space) {
+        return;
+    }
+    holds_space = false;
+    store.streaming.erase(placement.record);
+    releasePlacement(store, placement);
+    store.metadata.used_blocks = store.bitmap.count();
 }
 
 // Main put function
 std::string put(int store_id, const std::string& file_path, const std::string& file_content) {
-    // Check if we need to recover from previous crashes
-    recoverFromLog(store_id);
-
-    // 0. Load metadata
-    StoreMetadata store_metadata{};
-    std::vector<BlockMetadata> block_metadata(NUM_BLOCKS);
-    if (!readStoreMetadata(store_id, store_metadata, block_metadata)) {
+    // Use the resident metadata
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to load metadata of store " << store_id << std::endl;
         return "";
     }
 
-    std::string object_id = generateUniqueId();
-    // 1. Find free block or replace existing file if file path matches
-    int block_num = allocateBlock(store_id, file_path, block_metadata);
+    // The object stored under this path before is replaced
+    std::string object_id = newObjectId(*store->engine);
+    return store->engine->put({{object_id, file_path, file_content}}) ? object_id : "";
+}
 
-    // If no free blocks available, return empty string
-    if (block_num == -1) {
-        std::cerr << "No free blocks available" << std::endl;
-        return "";
+/**
+ * @brief A Put whose content arrives in pieces, written by a stream of the
+ *        store's engine. Only putBegin, putCommit and putAbort need the
+ *        store locked exclusively; the pieces are appended without the lock.
+ */
+struct StreamedPut {
+    int store_id;
+    std::shared_ptr<StoreState> store;
+    std::string file_path;
+    std::string object_id;
+    size_t file_size = 0;
+    size_t written = 0;             // Bytes of content written so far
+    std::unique_ptr<ObjectStream> stream;
+    bool finished = false;          // Committed or aborted already
+};
+
+// Helper function to tell whether the store of a put is still the one
+// registered under its ID, a Destroy or a new Init may have replaced it
+static bool isCurrentStore(const StreamedPut& put) {
+    return StoreRegistry::instance().acquire(put.store_id) == put.store;
+}
+
+/**
+ * @brief Starts a streamed Put, the engine makes room for the object. The
+ *        store must be locked exclusively.
+ *
+ * @param store_id      - ID of the store.
+ * @param file_path     - Path of the object, an object stored under it is replaced at the commit.
+ * @param file_size     - Size of the whole object.
+ * @return The put to append the content to, or null if there is no room.
+ */
+std::shared_ptr<StreamedPut> putBegin(int store_id, const std::string& file_path, size_t file_size) {
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to load metadata of store " << store_id << std::endl;
+        return nullptr;
     }
 
-    // 2. Write content to block
-    if (!putContentToBlock(store_id, block_num, file_content)) {
+    auto put = std::make_shared<StreamedPut>();
+    put->store_id = store_id;
+    put->store = store;
+    put->file_path = file_path;
+    put->object_id = newObjectId(*store->engine);
+    put->file_size = file_size;
+    put->stream = store->engine->begin(put->object_id, file_path, file_size);
+    return put->stream ? put : nullptr;
+}
+
+/**
+ * @brief Writes the next piece of a streamed Put. Needs no store lock.
+ *
+ * @param put   - The put started by putBegin.
+ * @param data  - Next bytes of the content.
+ * @param size  - Number of bytes.
+ * @return true if the piece was written; false otherwise
+ */
+bool putAppend(StreamedPut& put, const char* data, size_t size) {
+    if (put.written + size > put.file_size) {
+        std::cerr << "Put of " << put.file_path << " sent more than its " << put.file_size
+                  << " bytes" << std::endl;
+        return false;
+    }
+    if (!put.stream->append(data, size)) {
+        return false;
+    }
+    put.written += size;
+    return true;
+}
+
+/**
+ * @brief Makes a streamed Put visible once all of its content is written.
+ *        The store must be locked exclusively. A put that fails to commit
+ *        still has to be aborted.
+ *
+ * @param put   - The put started by putBegin.
+ * @return The ID of the new object, or an empty string on failure.
+ */
+std::string putCommit(StreamedPut& put) {
+    if (put.written != put.file_size) {
+        std::cerr << "Put of " << put.file_path << " ended after " << put.written << " of "
+                  << put.file_size << " bytes" << std::endl;
+        return "";
+    }
+    if (!isCurrentStore(put)) {
+        std::cerr << "Store " << put.store_id << " was removed during the Put of " << put.file_path << std::endl;
         return "";
     }
 
-    // 3. Update metadata
-    if (!updateMetadata(store_id, block_num, object_id, file_path, file_content.size(), store_metadata, block_metadata)) {
+    if (!put.stream->commit()) {
         return "";
     }
+    put.finished = true;
+    return put.object_id;
+}
+
+/**
+ * @brief Drops a streamed Put that will not be committed and gives its
+ *        space back. The store must be locked exclusively. Does nothing if
+ *        the put is finished or its store was removed meanwhile.
+ *
+ * @param put   - The put started by putBegin.
+ */
+void putAbort(StreamedPut& put) {
+    if (put.finished) {
+        return;
+    }
+    put.finished = true;
+    if (isCurrentStore(put)) {
+        put.stream->abort();
+    }
+}
 
-    // 4. Write commit log
-    LogEntry commit_entry{LogEntry::COMMIT};
-    writeLogEntry(store_id, commit_entry);
+/**
+ * @brief Stores many objects in one store as a single transaction. If
+ *        anything fails none of the objects is stored.
+ *
+ * @param store_id  - ID of the store.
+ * @param objects   - File path and content of each object.
+ * @return The IDs of the new objects in request order, or an empty list on failure.
+ */
+std::vector<std::string> putBatch(int store_id,
+                                  const std::vector<std::pair<std::string, std::string>>& objects) {
+    std::shared_ptr<StoreState> store = StoreRegistry::instance().acquire(store_id);
+    if (!store) {
+        std::cerr << "Failed to load metadata of store " << store_id << std::endl;
+        return {};
+    }
 
-    return object_id;
+    std::vector<std::string> object_ids;
+    std::vector<ObjectWrite> writes;
+    for (size_t i = 0; i < objects.size(); i++) {
+        object_ids.push_back(newObjectId(*store->engine));
+    }
+    for (size_t i = 0; i < objects.size(); i++) {
+        writes.push_back({object_ids[i], objects[i].first, objects[i].second});
+    }
+    return store->engine->put(writes) ? object_ids : std::vector<std::string>{};
 }
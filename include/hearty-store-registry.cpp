@@ -0,0 +1,457 @@
+/**
+ * @file hearty-store-registry.cpp
+ * @author Nathadon Samairat
+ * @brief Loads store metadata into memory once and writes changes back to disk.
+ * @version 0.1
+ * @date 2024-12-07
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "hearty-store-registry.hpp"
+
+/**
+ * @brief Returns the process wide registry.
+ */
+StoreRegistry& StoreRegistry::instance() {
+    static StoreRegistry registry;
+    return registry;
+}
+
+/**
+ * @brief Returns the resident metadata of a store, loading it on first access.
+ *
+ * @param store_id  - ID of the store.
+ * @return The store, or nullptr if it does not exist or cannot be loaded.
+ */
+std::shared_ptr<StoreState> StoreRegistry::acquire(int store_id) {
+    {
+        // Only one caller loads a store, the log must be replayed exactly once
+        std::unique_lock<std::mutex> lock(registry_lock);
+        loaded_cv.wait(lock, [&] { return loading.count(store_id) == 0; });
+        auto it = stores.find(store_id);
+        if (it != stores.end()) {
+            return it->second;
+        }
+        if (!utils::storeExists(store_id)) {
+            return nullptr;
+        }
+        loading.insert(store_id);
+    }
+
+    // Load outside the registry lock so other stores are not held up
+    auto store = std::make_shared<StoreState>();
+    bool loaded = loadStoreMetadata(store_id, *store);
+
+    std::lock_guard<std::mutex> lock(registry_lock);
+    loading.erase(store_id);
+    loaded_cv.notify_all();
+    if (!loaded) {
+        return nullptr;
+    }
+    stores[store_id] = store;
+    return store;
+}
+
+std::shared_ptr<const void> PlacementPins::pin(int record) {
+    {
+        std::lock_guard<std::mutex> lock(pins_lock);
+        counts[record]++;
+    }
+    std::shared_ptr<PlacementPins> self = shared_from_this();
+    return std::shared_ptr<const void>(nullptr, [self, record](const void*) {
+        std::lock_guard<std::mutex> lock(self->pins_lock);
+        auto it = self->counts.find(record);
+        if (it != self->counts.end() && --it->second == 0) {
+            self->counts.erase(it);
+        }
+    });
+}
+
+bool PlacementPins::pinned(int record) {
+    std::lock_guard<std::mutex> lock(pins_lock);
+    return counts.count(record) > 0;
+}
+
+/**
+ * @brief Registers a store that was just created, replacing any stale copy.
+ *
+ * @param store - The metadata of the new store.
+ */
+void StoreRegistry::add(std::shared_ptr<StoreState> store) {
+    std::shared_ptr<StoreState> stale;
+    {
+        std::lock_guard<std::mutex> lock(registry_lock);
+        std::shared_ptr<StoreState>& entry = stores[store->store_id];
+        stale = std::move(entry);
+        entry = std::move(store);
+    }
+    markRemoved(stale);
+}
+
+/**
+ * @brief Forgets a store, e.g. once it has been destroyed. Returns once no
+ *        checkpoint works on it any more, so its files can go.
+ *
+ * @param store_id  - ID of the store.
+ */
+void StoreRegistry::remove(int store_id) {
+    std::shared_ptr<StoreState> removed;
+    {
+        std::lock_guard<std::mutex> lock(registry_lock);
+        auto it = stores.find(store_id);
+        if (it == stores.end()) {
+            return;
+        }
+        removed = std::move(it->second);
+        stores.erase(it);
+    }
+    markRemoved(removed);
+}
+
+// Helper function to stop the checkpoints of a store that left the registry.
+// A new store may reuse its ID and with it the paths of its files.
+void StoreRegistry::markRemoved(const std::shared_ptr<StoreState>& store) {
+    if (!store) {
+        return;
+    }
+    std::lock_guard<std::mutex> maintenance(store->maintenance_lock);
+    store->removed = true;
+}
+
+/**
+ * @brief Starts a thread that checkpoints every resident store once per
+ *        interval, so the log only holds what a crash could still need.
+ *
+ * @param interval  - Time between two checkpoints of a store.
+ */
+void StoreRegistry::startCheckpoints(std::chrono::milliseconds interval) {
+    stopCheckpoints();
+    stopping = false;
+    checkpointer = std::thread(&StoreRegistry::checkpointLoop, this, interval);
+}
+
+/**
+ * @brief Stops the checkpoint thread and waits for it.
+ */
+void StoreRegistry::stopCheckpoints() {
+    {
+        std::lock_guard<std::mutex> lock(checkpoint_lock);
+        stopping = true;
+    }
+    checkpoint_cv.notify_all();
+    if (checkpointer.joinable()) {
+        checkpointer.join();
+    }
+}
+
+void StoreRegistry::checkpointLoop(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(checkpoint_lock);
+    while (!checkpoint_cv.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+
+        std::vector<std::shared_ptr<StoreState>> resident;
+        {
+            std::lock_guard<std::mutex> guard(registry_lock);
+            for (const auto& entry : stores) {
+                resident.push_back(entry.second);
+            }
+        }
+        // The log serializes a checkpoint with the Puts appending to it, and
+        // a log-structured store its compaction. A store removed since the
+        // list was taken is skipped, its segment names may be a new store's.
+        for (const auto& store : resident) {
+            std::lock_guard<std::mutex> maintenance(store->maintenance_lock);
+            if (store->removed) {
+                continue;
+            }
+            store->engine->maintain();
+        }
+
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Opens the files of a store, reads metadata.bin in a single pass and
+ *        replays the log. A log-structured store is loaded from its segments.
+ *
+ * @param store_id  - ID of the store.
+ * @param store     - Filled with the store and block metadata.
+ * @return true if the metadata was read; false otherwise
+ */
+bool loadStoreMetadata(int store_id, StoreState& store) {
+    // Stores without an engine file predate the choice and use blocks
+    std::string engine_name;
+    std::ifstream engine_file(utils::getEnginePath(store_id));
+    StoreEngine engine = StoreEngine::BLOCK;
+    if (engine_file >> engine_name && !utils::parseEngine(engine_name, engine)) {
+        std::cerr << "Unknown engine " << engine_name << " of store " << store_id << std::endl;
+        return false;
+    }
+    if (engine == StoreEngine::LOG_STRUCTURED) {
+        auto log_structured = std::make_unique<LogStructuredStore>();
+        store.store_id = store_id;
+        if (!log_structured->open(store_id)) {
+            return false;
+        }
+        store.engine = std::move(log_structured);
+        return true;
+    }
+
+    if (!store.files.open(store_id) || !store.log.open(store_id, store.files)) {
+        return false;
+    }
+
+    if (!store.files.readMetadata(&store.metadata, sizeof(StoreMetadata), 0)) {
+        std::cerr << "Failed to read store metadata" << std::endl;
+        return false;
+    }
+
+    // Records of another layout would be misread, refuse the store instead
+    if (store.metadata.magic != STORE_MAGIC) {
+        std::cerr << "Store " << store_id << " has no store metadata header" << std::endl;
+        return false;
+    }
+    if (store.metadata.format_version != STORE_FORMAT_VERSION) {
+        std::cerr << "Store " << store_id << " has format version " << store.metadata.format_version
+                  << ", this server reads version " << STORE_FORMAT_VERSION << std::endl;
+        return false;
+    }
+    if (store.metadata.total_records < store.metadata.total_blocks) {
+        std::cerr << "Store " << store_id << " has a damaged metadata header" << std::endl;
+        return false;
+    }
+
+    store.store_id = store_id;
+    store.blocks.resize(store.metadata.total_records);
+    if (!store.files.readMetadata(store.blocks.data(), store.blocks.size() * sizeof(BlockMetadata),
+                                  sizeof(StoreMetadata))) {
+        std::cerr << "Failed to read block metadata" << std::endl;
+        return false;
+    }
+
+    buildIndexes(store);
+    store.engine = std::make_unique<BlockEngine>(store);
+
+    // Undo whatever an earlier run left unfinished before anyone reads the store
+    replayLog(store);
+    return true;
+}
+
+void BlockEngine::maintain() {
+    store.log.checkpoint();
+}
+
+std::string BlockEngine::describe() const {
+    std::ostringstream output;
+    output << "used: " << store.bitmap.count() << "/" << store.metadata.total_blocks << " blocks";
+    return output.str();
+}
+
+/**
+ * @brief Follows the extent chain of an object.
+ *
+ * @param store         - The store holding the object.
+ * @param head_block    - First block of the object, where its record lives.
+ * @return The runs of blocks holding the object, in order.
+ */
+std::vector<Extent> objectExtents(const StoreState& store, int head_block) {
+    std::vector<Extent> extents;
+    int total_blocks = store.metadata.total_blocks;
+    int covered = 0;
+    int block_num = head_block;
+    // A damaged chain can never cover more blocks than the store has
+    while (block_num >= 0 && block_num < total_blocks && covered < total_blocks) {
+        const BlockMetadata& record = store.blocks[block_num];
+        int num_blocks = std::min(std::max(record.extent_blocks, 1), total_blocks - block_num);
+        extents.push_back({block_num, num_blocks});
+        covered += num_blocks;
+        block_num = record.next_extent;
+    }
+    return extents;
+}
+
+// Helper function to mark the space of an object no record reaches yet as in use
+static void reservePlacement(StoreState& store, const Placement& placement) {
+    for (const Extent& extent : placement.extents) {
+        for (int b = 0; b < extent.num_blocks; b++) {
+            store.bitmap.set(extent.start_block + b);
+        }
+    }
+    if (placement.size_class == 0) {
+        return;
+    }
+
+    int block_num = placement.offset / BLOCK_SIZE;
+    auto inserted = store.slabs.try_emplace(block_num);
+    Slab& slab = inserted.first->second;
+    if (inserted.second) {
+        slab.size_class = placement.size_class;
+        slab.slots.resize(BLOCK_SIZE / utils::slotSize(placement.size_class));
+        store.bitmap.set(block_num);
+    }
+    slab.slots.set((placement.offset % BLOCK_SIZE) / utils::slotSize(slab.size_class));
+    store.slab_records.set(placement.record - store.metadata.total_blocks);
+}
+
+/**
+ * @brief Rebuilds the in-memory indexes of a store from its record table:
+ *        the object id index, the free block bitmap, the slabs and the path
+ *        map. A block or slot is in use only if an object record reaches it,
+ *        a streamed Put still writes to it or it is retired, so space left
+ *        behind by an unfinished Put comes back as free space.
+ *
+ * @param store - The store whose indexes are rebuilt.
+ */
+void buildIndexes(StoreState& store) {
+    size_t total_blocks = store.metadata.total_blocks;
+    store.index.clear();
+    store.index.reserve(total_blocks);
+    store.bitmap.resize(total_blocks);
+    store.paths.clear();
+    store.slabs.clear();
+    for (std::set<int>& open : store.open_slabs) {
+        open.clear();
+    }
+    store.slab_records.resize(store.blocks.size() - total_blocks);
+
+    for (size_t i = 0; i < store.blocks.size(); i++) {
+        const BlockMetadata& block = store.blocks[i];
+        if (!block.is_used || block.object_id[0] == '\0') {
+            continue;
+        }
+
+        if (i < total_blocks) {
+            for (const Extent& extent : objectExtents(store, i)) {
+                for (int b = 0; b < extent.num_blocks; b++) {
+                    store.bitmap.set(extent.start_block + b);
+                }
+            }
+        } else {
+            // Slab object, the slab itself is recreated from its slots
+            int block_num = block.offset / BLOCK_SIZE;
+            if (block.size_class < 1 || block.size_class > NUM_SIZE_CLASSES ||
+                block_num >= static_cast<int>(total_blocks)) {
+                std::cerr << "Skipping damaged slab record " << i << std::endl;
+                continue;
+            }
+            auto inserted = store.slabs.try_emplace(block_num);
+            Slab& slab = inserted.first->second;
+            if (inserted.second) {
+                slab.size_class = block.size_class;
+                slab.slots.resize(BLOCK_SIZE / utils::slotSize(block.size_class));
+                store.bitmap.set(block_num);
+            }
+            slab.slots.set((block.offset % BLOCK_SIZE) / utils::slotSize(slab.size_class));
+            store.slab_records.set(i - total_blocks);
+        }
+        store.index.insert(block.object_id, i);
+        store.paths[block.file_path] = i;
+    }
+    // Replaced objects stay reserved until reclaimRetired frees them, a Get
+    // may still be sending one
+    for (const RetiredPlacement& retired : store.retired) {
+        reservePlacement(store, retired.placement);
+    }
+    for (const auto& [record, placement] : store.streaming) {
+        reservePlacement(store, placement);
+    }
+    for (const auto& [block_num, slab] : store.slabs) {
+        if (slab.slots.count() < slab.slots.size()) {
+            store.open_slabs[slab.size_class - 1].insert(block_num);
+        }
+    }
+    store.metadata.used_blocks = store.bitmap.count();
+}
+
+/**
+ * @brief Appends SLAB_RECORD_GROWTH free slab records to the record table
+ *        of a store, up to NUM_SLAB_RECORDS in all. The new records are
+ *        written as zeros before the header counts them, so bytes left past
+ *        the old end of the table never come back as objects.
+ *
+ * @param store - The store that ran out of slab records.
+ * @return true if records were added; false if the store has the most it can
+ */
+bool growSlabRecords(StoreState& store) {
+    size_t slab_records = store.metadata.total_records - store.metadata.total_blocks;
+    if (slab_records >= NUM_SLAB_RECORDS) {
+        return false;
+    }
+
+    // Records logged so far go to the log file before metadata.bin changes
+    if (!store.log.writeOut()) {
+        std::cerr << "Failed to write the log of store " << store.store_id << std::endl;
+        return false;
+    }
+
+    size_t added = std::min(SLAB_RECORD_GROWTH, NUM_SLAB_RECORDS - slab_records);
+    std::vector<BlockMetadata> empty(added);
+    off_t offset = sizeof(StoreMetadata) + store.metadata.total_records * sizeof(BlockMetadata);
+    if (!store.files.writeMetadata(empty.data(), added * sizeof(BlockMetadata), offset)) {
+        std::cerr << "Failed to extend the record table of store " << store.store_id << std::endl;
+        return false;
+    }
+
+    StoreMetadata metadata = store.metadata;
+    metadata.total_records += added;
+    if (!store.files.writeMetadata(&metadata, sizeof(StoreMetadata), 0)) {
+        std::cerr << "Failed to write store metadata" << std::endl;
+        return false;
+    }
+    store.metadata.total_records = metadata.total_records;
+    store.blocks.resize(store.metadata.total_records);
+    store.slab_records.grow(slab_records + added);
+    return true;
+}
+
+/**
+ * @brief Writes the store header and the given block records in place.
+ *        metadata.bin keeps its layout (header followed by the block table),
+ *        so only the bytes of the changed records are rewritten, in the
+ *        order given.
+ *
+ * @param store         - The store to persist.
+ * @param block_nums    - The records that changed.
+ * @return true if all records were written; false otherwise
+ */
+bool saveBlockMetadata(StoreState& store, const std::vector<int>& block_nums) {
+    // The log records of these changes go to the log file first
+    if (!store.log.writeOut()) {
+        std::cerr << "Failed to write the log of store " << store.store_id << std::endl;
+        return false;
+    }
+
+    // Records that follow each other in the list and in the file go out in one write
+    size_t i = 0;
+    while (i < block_nums.size()) {
+        int first = block_nums[i];
+        size_t count = 1;
+        while (i + count < block_nums.size() && block_nums[i + count] == first + static_cast<int>(count)) {
+            count++;
+        }
+
+        off_t block_offset = sizeof(StoreMetadata) + first * sizeof(BlockMetadata);
+        if (!store.files.writeMetadata(&store.blocks[first], count * sizeof(BlockMetadata), block_offset)) {
+            std::cerr << "Failed to write metadata of block " << first << std::endl;
+            return false;
+        }
+        i += count;
+    }
+
+    if (!store.files.writeMetadata(&store.metadata, sizeof(StoreMetadata), 0)) {
+        std::cerr << "Failed to write store metadata" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool saveBlockMetadata(StoreState& store, int block_num) {
+    return saveBlockMetadata(store, std::vector<int>{block_num});
+}
@@ -0,0 +1,173 @@
+/**
+ * @file hearty-store-registry.hpp
+ * @author Nathadon Samairat
+ * @brief Keeps the metadata of every store resident in memory. A store is
+ *        loaded once (at Init or on first access) and the handlers work on
+ *        that copy, writing their changes through to metadata.bin.
+ * @version 0.1
+ * @date 2024-12-07
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_REGISTRY_HPP
+#define HEARTY_STORE_REGISTRY_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "hearty-store-server.hpp"
+#include "hearty-store-object-index.hpp"
+#include "hearty-store-block-bitmap.hpp"
+#include "hearty-store-files.hpp"
+#include "hearty-store-wal.hpp"
+#include "hearty-store-engine.hpp"
+#include "hearty-store-log-engine.hpp"
+
+/**
+ * @brief In-memory copy of one store's metadata.bin.
+ *
+ * The registry does not lock a store; callers hold the store lock (shared to
+ * read, exclusive to modify) while they use it.
+ */
+struct Slab {
+    int size_class;         // Size class of the slots, plus one
+    BlockBitmap slots;      // Which slots hold an object
+};
+
+// Where the content of an object lives: a slab slot or a chain of extents
+struct Placement {
+    int record = -1;                // Record describing the object
+    int size_class = 0;             // Slab size class plus one, 0 for extents
+    size_t offset = 0;              // Byte offset of the slab slot in data.bin
+    std::vector<Extent> extents;    // Runs of blocks of an object stored in extents
+    std::vector<uint32_t> checksums;    // CRC32C of each block of content written so far
+};
+
+/**
+ * @brief Records of objects a Get is still sending from the mapping. The
+ *        space of a pinned object is not reused, even once it has been
+ *        replaced, so the Get needs no store lock while the bytes go out.
+ */
+class PlacementPins : public std::enable_shared_from_this<PlacementPins> {
+private:
+    std::mutex pins_lock;
+    std::unordered_map<int, int> counts;    // record -> Gets using it
+
+public:
+    // Pins a record until the returned handle is dropped, from any thread
+    std::shared_ptr<const void> pin(int record);
+    bool pinned(int record);
+};
+
+// Space of a replaced object, reusable once the commit that replaced it is durable
+struct RetiredPlacement {
+    uint64_t commit_position;       // Log position after that COMMIT record
+    Placement placement;
+};
+
+struct StoreState {
+    int store_id;
+    StoreMetadata metadata;
+    std::vector<BlockMetadata> blocks;  // Block records followed by slab records
+    ObjectIndex index;      // object_id -> record of every stored object
+    BlockBitmap bitmap;     // Which blocks are in use, slabs included
+    std::unordered_map<std::string, int> paths;    // file_path -> record, for overwrites
+    std::unordered_map<int, Slab> slabs;           // block -> slab carved out of it
+    BlockBitmap slab_records;   // Which slab records are in use
+    std::set<int> open_slabs[NUM_SIZE_CLASSES];    // Per size class, slabs with a free slot
+    StoreFiles files;       // data.bin and metadata.bin, open while the store is resident
+    GroupCommitLog log;     // Write-ahead log, synced together with the files
+    std::vector<RetiredPlacement> retired;     // Replaced objects whose space is not free yet
+    std::unordered_map<int, Placement> streaming;  // record -> space of a streamed Put not committed yet
+    std::shared_ptr<PlacementPins> pins = std::make_shared<PlacementPins>();
+    // Engine of the store, a log-structured store uses none of the above
+    std::unique_ptr<StorageEngine> engine;
+    std::mutex maintenance_lock;    // Held while a checkpoint or compaction runs on the store
+    bool removed = false;           // Left the registry, guarded by maintenance_lock
+};
+
+/**
+ * @brief The block engine, which keeps objects in the blocks and slab slots
+ *        of data.bin and works on the records of its store. Puts write to
+ *        free space and are made visible by their record updates, logged to
+ *        the write-ahead log.
+ */
+class BlockEngine : public StorageEngine {
+private:
+    StoreState& store;
+
+public:
+    explicit BlockEngine(StoreState& store) : store(store) {}
+
+    bool contains(const std::string& object_id) const override;
+    bool size(const std::string& object_id, uint64_t& data_size) const override;
+
+    // Writes every object to free space, then applies all record changes
+    // with one metadata flush and one COMMIT
+    bool put(const std::vector<ObjectWrite>& writes) override;
+
+    // Allocates the space of the whole object up front
+    std::unique_ptr<ObjectStream> begin(const std::string& object_id, const std::string& file_path,
+                                        size_t data_size) override;
+
+    bool sync() override;
+
+    bool readChunks(const std::string& object_id, uint64_t offset, uint64_t length,
+                    const StoreFiles::ChunkCallback& on_chunk) const override;
+    bool readMapped(const std::string& object_id, uint64_t offset, uint64_t length,
+                    MappedObject& object) const override;
+    bool readBatch(const std::vector<std::string>& object_ids,
+                   std::vector<std::string>& contents, std::vector<bool>& found) const override;
+
+    // Checkpoints the write-ahead log
+    void maintain() override;
+
+    std::string describe() const override;
+};
+
+class StoreRegistry {
+private:
+    std::mutex registry_lock;
+    std::condition_variable loaded_cv;
+    std::unordered_map<int, std::shared_ptr<StoreState>> stores;
+    std::unordered_set<int> loading;    // Stores being loaded and replayed right now
+
+    std::thread checkpointer;
+    std::mutex checkpoint_lock;
+    std::condition_variable checkpoint_cv;
+    bool stopping = false;
+
+    void checkpointLoop(std::chrono::milliseconds interval);
+    static void markRemoved(const std::shared_ptr<StoreState>& store);
+
+public:
+    ~StoreRegistry() { stopCheckpoints(); }
+
+    static StoreRegistry& instance();
+
+    std::shared_ptr<StoreState> acquire(int store_id);
+    void add(std::shared_ptr<StoreState> store);
+    void remove(int store_id);
+
+    // Checkpoints the log of every resident store in the background and
+    // compacts the log-structured ones
+    void startCheckpoints(std::chrono::milliseconds interval);
+    void stopCheckpoints();
+};
+
+bool loadStoreMetadata(int store_id, StoreState& store);
+std::vector<Extent> objectExtents(const StoreState& store, int head_block);
+void buildIndexes(StoreState& store);
+bool growSlabRecords(StoreState& store);
+bool saveBlockMetadata(StoreState& store, int block_num);
+bool saveBlockMetadata(StoreState& store, const std::vector<int>& block_nums);
+
+#endif // HEARTY_STORE_REGISTRY_HPP
@@ -1,29 +1,79 @@
 #ifndef HEARTY_STORE_COMMON_HPP
 #define HEARTY_STORE_COMMON_HPP
 
+#include <algorithm>
+#include <charconv>
 #include <string>
+#include <cstdint>
 #include <cstring>
 #include <vector>
 #include <filesystem>
+#include <functional>
+#include <memory>
 
 const size_t BLOCK_SIZE = 1024 * 1024;              // 1MB
 const size_t NUM_BLOCKS = 1024;                     // 1024 blocks
+const size_t GET_CHUNK_SIZE = 256 * 1024;           // Content bytes per streamed Get message
+const size_t GET_PIPELINE_DEPTH = 2;                // Chunks of one Get held at once: one sent, one read
+const size_t SEQUENTIAL_READ_SIZE = BLOCK_SIZE;     // Reads this large use the sequential read-ahead
+const size_t BATCH_READ_GAP = 64 * 1024;            // Largest gap a BatchGet reads over to merge two reads
 const std::string BASE_PATH = "/tmp/hearty";        // Default path to storage
 const std::string DATA_FILENAME = "/data.bin";      // Actual data file name
 const std::string META_FILENAME = "/metadata.bin";  // Meta data file name
 const std::string STORE_DIR = "/store_";            // Default path to storage
+const std::string LOG_PREFIX = "/log-";             // Log segment file names: log-<number>.bin
+const std::string LOG_SUFFIX = ".bin";
+const std::string ENGINE_FILENAME = "/engine";      // Names the engine of a store, absent for block stores
+const std::string SEGMENT_PREFIX = "/segment-";     // Object segments of log-structured stores
+const std::string SEGMENT_SUFFIX = ".dat";
 
+// Storage engines a store can be created with
+enum class StoreEngine {
+    BLOCK,              // Objects in 1MB blocks of data.bin, records in metadata.bin, changes logged
+    LOG_STRUCTURED      // Objects appended to segment files, indexed in memory
+};
+
+// Small objects share blocks: a slab is one block cut into equal slots of a
+// size class. Their records follow the block records in metadata.bin.
+const size_t SLAB_SIZE_CLASSES[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024};
+const int NUM_SIZE_CLASSES = 4;
+const size_t NUM_SLAB_RECORDS = NUM_BLOCKS * 64;    // Slab objects a store can hold
+const size_t SLAB_RECORD_GROWTH = 1024;             // Slab records added to a store when it runs out
+
+// An object is stored as one or more extents, runs of contiguous blocks.
+// The record of the first block of each run describes the run and links to
+// the next one; the first run's record also holds the object itself.
+// An object small enough for a slab has a slab record instead, pointing at
+// its slot.
 struct BlockMetadata {
     bool is_used;           // Is this block currently storing an object
     char object_id[32];     // Unique identifier for the object in this block
-    size_t data_size;       // Actual size of data in the block
+    size_t data_size;       // Actual size of the whole object
     time_t timestamp;       // Last modification time will be used for object ID
     char file_path[128];    // File path of the object will be used for replacement
+    int extent_blocks;      // Number of blocks in the run starting at this block
+    int next_extent;        // First block of the object's next run, -1 if last
+    int size_class;         // Slab size class plus one, 0 for objects stored in extents
+    uint32_t checksum;      // CRC32C of the object bytes in this block or slab slot, 0 if unknown
+    size_t offset;          // Byte offset of the slab slot in data.bin
+};
+
+struct Extent {
+    int start_block;
+    int num_blocks;
 };
 
+// metadata.bin starts with a magic number and the version of its layout;
+// bump the version whenever StoreMetadata or BlockMetadata change
+const uint32_t STORE_MAGIC = 0x48525453;            // "STRH" on disk
+const uint32_t STORE_FORMAT_VERSION = 1;
+
 struct StoreMetadata {
+    uint32_t magic;          // STORE_MAGIC
+    uint32_t format_version; // Layout of this header and of the records
     int store_id;
     size_t total_blocks;     // Always 1024
+    size_t total_records;    // Block records followed by slab records
     size_t block_size;       // Always 1MB
     size_t used_blocks;      // Number of blocks currently in use
 };
@@ -35,16 +85,65 @@ struct LogEntry {
         ADD_ENTRY,
         COMMIT
     } type;
-    int block_index;
-    std::string checksum;
-    std::string old_block_data;
-    std::string object_id;
-    size_t data_size;
-    std::string file_path;
+    // Defaulted so an entry names only the fields of its type
+    int block_index = -1;
+    std::string checksum{};
+    std::string old_block_data{};
+    std::string object_id{};
+    size_t data_size = 0;
+    std::string file_path{};
+    // ADD_ENTRY: the records of the replaced object as they were, put back by a rollback
+    std::vector<std::pair<int, BlockMetadata>> replaced_records{};
+};
+
+class DataMapping;
+
+// Bytes [from, from + size) of a buffer holding part of an object
+struct ObjectPiece {
+    std::shared_ptr<const std::string> data;
+    size_t from = 0;
+    size_t size = 0;
+};
+
+// Read-only views of an object inside a mapped file of its store. An object
+// served from the buffer pool has no views; its pieces are fetched one at a
+// time as they are sent instead.
+struct MappedObject {
+    std::shared_ptr<const DataMapping> mapping;             // Keeps the views valid
+    std::shared_ptr<const void> pin;                        // Keeps the object's space from being reused
+    std::vector<std::pair<const char*, size_t>> ranges;     // In object order
+    uint64_t offset = 0;                // Byte of the object the first view starts at
+    uint64_t data_size = 0;
+    std::vector<uint32_t> checksums;    // CRC32C of each block of the object, 0 where there is none
+    // Set for an object served from the buffer pool: gets the piece from a
+    // byte of the object up to the end of its pool block, reading it on a
+    // miss. The bytes [offset, end) are sent that way.
+    std::function<bool(uint64_t position, ObjectPiece& piece)> read_piece;
+    uint64_t end = 0;                   // End of the bytes sent, from the views or the pool
 };
 
 // Utility functions
 namespace utils {
+    // Returns the smallest slab size class (plus one) that fits, 0 if none does
+    inline int sizeClassOf(size_t size) {
+        for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+            if (size <= SLAB_SIZE_CLASSES[i]) {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    inline size_t slotSize(int size_class) {
+        return SLAB_SIZE_CLASSES[size_class - 1];
+    }
+
+    // End of the bytes [offset, offset + length) of an object, cut at its end
+    // without overflowing. A length of 0 reads to the end; offset <= data_size.
+    inline uint64_t rangeEnd(uint64_t offset, uint64_t length, uint64_t data_size) {
+        return length == 0 ? data_size : offset + std::min(length, data_size - offset);
+    }
+
     inline std::string getStorePath(int store_id) {
         return BASE_PATH + STORE_DIR + std::to_string(store_id);
     }
@@ -57,24 +156,102 @@ namespace utils {
         return getStorePath(store_id) + META_FILENAME;
     }
 
-    inline std::string getLogPath(int store_id) {
-        return getStorePath(store_id) + "-log.txt";
+    // Segments of the log live in the store directory, numbered in order
+    inline std::string getLogPath(int store_id, uint64_t segment) {
+        std::string number = std::to_string(segment);
+        return getStorePath(store_id) + LOG_PREFIX + std::string(10 - std::min<size_t>(number.size(), 10), '0') +
+               number + LOG_SUFFIX;
+    }
+
+    // Object segments of a log-structured store, numbered in order of creation
+    inline std::string getSegmentPath(int store_id, uint64_t segment) {
+        std::string number = std::to_string(segment);
+        return getStorePath(store_id) + SEGMENT_PREFIX + std::string(10 - std::min<size_t>(number.size(), 10), '0') +
+               number + SEGMENT_SUFFIX;
+    }
+
+    // Reads the number out of a segment name "/<prefix><digits><suffix>",
+    // false for any other file found in the store directory
+    inline bool parseSegmentName(const std::string& name, const std::string& prefix,
+                                 const std::string& suffix, uint64_t& number) {
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return false;
+        }
+        const char* first = name.data() + prefix.size();
+        const char* last = name.data() + name.size() - suffix.size();
+        auto [end, error] = std::from_chars(first, last, number);
+        return error == std::errc() && end == last;
+    }
+
+    inline std::string getEnginePath(int store_id) {
+        return getStorePath(store_id) + ENGINE_FILENAME;
+    }
+
+    // Reads an engine name as given at Init, an empty name is the block engine
+    inline bool parseEngine(const std::string& name, StoreEngine& engine) {
+        if (name.empty() || name == "block") {
+            engine = StoreEngine::BLOCK;
+        } else if (name == "log") {
+            engine = StoreEngine::LOG_STRUCTURED;
+        } else {
+            return false;
+        }
+        return true;
     }
 
     // Checks if a store exists
     inline bool storeExists(int store_id) {
         return std::filesystem::exists(getStorePath(store_id));
     }
+
+    // Returns the IDs of all stores found under BASE_PATH, skipping
+    // directories whose name is not "store_<id>"
+    inline std::vector<int> getStoreIds() {
+        std::vector<int> store_ids;
+        if (!std::filesystem::exists(BASE_PATH)) {
+            return store_ids;
+        }
+
+        for (const auto& entry : std::filesystem::directory_iterator(BASE_PATH)) {
+            if (!entry.is_directory()) continue;
+
+            std::string dirname = entry.path().filename().string();
+            if (dirname.size() <= 6 || dirname.compare(0, 6, "store_") != 0) continue;
+
+            int store_id;
+            const char* last = dirname.data() + dirname.size();
+            auto [end, error] = std::from_chars(dirname.data() + 6, last, store_id);
+            if (error != std::errc() || end != last || store_id < 0) continue;
+            store_ids.push_back(store_id);
+        }
+        return store_ids;
+    }
 }
 
-std::string calculateMD5(const std::string& data);
-void writeLogEntry(int store_id, const LogEntry& entry);
+uint64_t writeLogEntry(int store_id, const LogEntry& entry);
 void recoverFromLog(int store_id);
+bool syncLog(int store_id);
 
-#endif // HEARTY_STORE_COMMON_HPP
-
-bool initialize(int store_id);
+bool initialize(int store_id, bool preallocate = false, StoreEngine engine = StoreEngine::BLOCK);
 std::string put(int store_id, const std::string& file_path, const std::string& file_content);
+struct StreamedPut;
+std::shared_ptr<StreamedPut> putBegin(int store_id, const std::string& file_path, size_t file_size);
+bool putAppend(StreamedPut& put, const char* data, size_t size);
+std::string putCommit(StreamedPut& put);
+void putAbort(StreamedPut& put);
+std::vector<std::string> putBatch(int store_id,
+                                  const std::vector<std::pair<std::string, std::string>>& objects);
 std::string list_stores();
 std::string get(int store_id, const std::string object_id);
-bool destroy_store(int store_id);
\ No newline at end of file
+bool getChunks(int store_id, const std::string& object_id, uint64_t offset, uint64_t length,
+               const std::function<void(const char* data, size_t size)>& on_chunk);
+bool getMapped(int store_id, const std::string& object_id, uint64_t offset, uint64_t length,
+               MappedObject& object);
+bool checkMappedBlock(const std::string& object_id, const MappedObject& object, uint64_t position,
+                      uint64_t& checked);
+bool getBatch(int store_id, const std::vector<std::string>& object_ids,
+              std::vector<std::string>& contents, std::vector<bool>& found);
+bool destroy_store(int store_id);
+
+#endif // HEARTY_STORE_COMMON_HPP
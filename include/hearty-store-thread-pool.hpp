@@ -0,0 +1,81 @@
+/**
+ * @file hearty-store-thread-pool.hpp
+ * @author Nathadon Samairat
+ * @brief A fixed-size pool of worker threads fed from a FIFO task queue.
+ * @version 0.1
+ * @date 2024-12-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_THREAD_POOL_HPP
+#define HEARTY_STORE_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_lock;
+    std::condition_variable queue_cv;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queue_lock);
+                queue_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t num_threads) {
+        if (num_threads == 0) {
+            num_threads = 1;
+        }
+        for (size_t i = 0; i < num_threads; i++) {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    // Runs the queued tasks to completion before joining the workers
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(queue_lock);
+            stopping = true;
+        }
+        queue_cv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(queue_lock);
+            tasks.push(std::move(task));
+        }
+        queue_cv.notify_one();
+    }
+
+    size_t size() const { return workers.size(); }
+};
+
+#endif // HEARTY_STORE_THREAD_POOL_HPP
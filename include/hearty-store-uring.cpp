@@ -0,0 +1,523 @@
+/**
+ * @file hearty-store-uring.cpp
+ * @author Nathadon Samairat
+ * @brief io_uring rings and the storage engine built on them.
+ * @version 0.1
+ * @date 2024-12-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE       // From linux/fs.h, the store's BLOCK_SIZE is used below
+#include "hearty-store-uring.hpp"
+#include "hearty-store-server.hpp"
+
+void UringCompletion::set(int res) {
+    std::lock_guard<std::mutex> guard(lock);
+    result = res;
+    done = true;
+    done_cv.notify_one();
+}
+
+int UringCompletion::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    done_cv.wait(guard, [this] { return done; });
+    return result;
+}
+
+// Helper function to enter the kernel, retrying when interrupted
+static int uringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, _NSIG / 8);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        return ret < 0 ? -errno : ret;
+    }
+}
+
+IoUring::~IoUring() {
+    if (sqes) {
+        munmap(sqes, sqes_map_size);
+    }
+    if (cq_ptr && cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_map_size);
+    }
+    if (sq_ptr) {
+        munmap(sq_ptr, sq_map_size);
+    }
+    if (ring_fd >= 0) {
+        close(ring_fd);
+    }
+}
+
+/**
+ * @brief Creates the ring and maps its queues into the process.
+ *
+ * @param entries   - Number of submission queue entries.
+ * @return true if the ring is ready; false otherwise
+ */
+bool IoUring::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+    }
+
+    sq_ptr = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            return false;
+        }
+    }
+    sqes_map_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes_ptr = mmap(nullptr, sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+
+    char* sq = static_cast<char*>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+
+    char* cq = static_cast<char*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+/**
+ * @brief Hands out the next free submission queue entry.
+ *
+ * @return The entry, or nullptr if the queue is full until the next submit.
+ */
+io_uring_sqe* IoUring::getSqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head >= sq_entries) {
+        return nullptr;
+    }
+    unsigned index = sqe_tail & *sq_mask;
+    sq_array[index] = index;
+    sqe_tail++;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Publishes the prepared entries and submits them in one system call.
+ *        If the kernel stays busy past URING_SUBMIT_RETRIES tries or fails,
+ *        the entries it has not taken are withdrawn, so nobody waits for
+ *        them and a later submit cannot send them on.
+ *
+ * @return Number of entries submitted, or a negative errno.
+ */
+int IoUring::submit() {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned pending = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    int submitted = 0;
+    int retries = 0;
+    while (pending > 0) {
+        int ret = uringEnter(ring_fd, pending, 0, 0);
+        if ((ret == -EAGAIN || ret == -EBUSY) && ++retries <= URING_SUBMIT_RETRIES) {
+            // Completions are backed up, let the completion thread catch up
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        if (ret <= 0) {
+            withdraw();
+            return ret < 0 ? ret : -EIO;
+        }
+        submitted += ret;
+        pending -= ret;
+    }
+    return submitted;
+}
+
+// Drops the published entries the kernel has not taken. Only valid while
+// nobody else submits: the kernel reads the queue on submit only.
+void IoUring::withdraw() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    sqe_tail = head;
+    __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+}
+
+// Blocks until at least one completion is posted
+int IoUring::waitCompletions() {
+    return uringEnter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+}
+
+template <typename Handler>
+void IoUring::drainCompletions(Handler&& handle) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        handle(cqes[head & *cq_mask]);
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+int IoUring::registerBuffers(const std::vector<struct iovec>& buffers) {
+    return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                   buffers.data(), buffers.size());
+}
+
+int IoUring::registerFiles(const std::vector<int>& fds) {
+    return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES, fds.data(), fds.size());
+}
+
+int IoUring::updateFile(unsigned slot, int fd) {
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+static std::unique_ptr<UringEngine> engine_instance;
+static std::atomic<UringEngine*> active_engine{nullptr};
+
+/**
+ * @brief Starts the process wide engine. Store files opened afterwards do
+ *        their I/O through it.
+ *
+ * @return true if io_uring is usable; false if the kernel refuses it.
+ */
+bool UringEngine::start() {
+    if (active_engine.load()) {
+        return true;
+    }
+    std::unique_ptr<UringEngine> engine(new UringEngine());
+    if (!engine->init()) {
+        return false;
+    }
+    engine_instance = std::move(engine);
+    active_engine.store(engine_instance.get());
+    return true;
+}
+
+// Returns the running engine, or nullptr when the plain pread/pwrite path is used
+UringEngine* UringEngine::active() {
+    return active_engine.load();
+}
+
+bool UringEngine::init() {
+    if (!ring.init(URING_QUEUE_DEPTH)) {
+        std::cerr << "io_uring_setup failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Fixed file table, filled in as stores are opened
+    std::vector<int> slots(URING_MAX_FILES, -1);
+    if (ring.registerFiles(slots) < 0) {
+        std::cerr << "Failed to register the fixed file table: " << strerror(errno) << std::endl;
+        return false;
+    }
+    for (int slot = URING_MAX_FILES - 1; slot >= 0; slot--) {
+        free_slots.push_back(slot);
+    }
+
+    // Registered buffers for chunked reads
+    std::vector<struct iovec> iovecs;
+    for (size_t i = 0; i < URING_NUM_BUFFERS; i++) {
+        char* buffer = static_cast<char*>(aligned_alloc(4096, GET_CHUNK_SIZE));
+        if (!buffer) {
+            break;
+        }
+        buffers.push_back(buffer);
+        free_buffers.push_back(i);
+        iovecs.push_back({buffer, GET_CHUNK_SIZE});
+    }
+    if (buffers.empty() || ring.registerBuffers(iovecs) < 0) {
+        std::cerr << "Failed to register io_uring buffers: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    reaper = std::thread(&UringEngine::reapLoop, this);
+    return true;
+}
+
+UringEngine::~UringEngine() {
+    active_engine.store(nullptr);
+    if (reaper.joinable()) {
+        // A no-op without a completion wakes the completion thread up to stop
+        stopping = true;
+        {
+            std::lock_guard<std::mutex> lock(submit_lock);
+            io_uring_sqe* sqe = ring.getSqe();
+            while (!sqe) {
+                ring.submit();
+                sqe = ring.getSqe();
+            }
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+            ring.submit();
+        }
+        reaper.join();
+    }
+    for (char* buffer : buffers) {
+        free(buffer);
+    }
+}
+
+void UringEngine::reapLoop() {
+    while (true) {
+        ring.waitCompletions();
+        ring.drainCompletions([](const io_uring_cqe& cqe) {
+            if (cqe.user_data != 0) {
+                reinterpret_cast<UringCompletion*>(cqe.user_data)->set(cqe.res);
+            }
+        });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Puts a file into the fixed file table.
+ *
+ * @param fd    - Open file descriptor.
+ * @return The slot, or -1 if the table is full and the fd is used as is.
+ */
+int UringEngine::registerFile(int fd) {
+    std::lock_guard<std::mutex> lock(files_lock);
+    if (free_slots.empty()) {
+        return -1;
+    }
+    int slot = free_slots.back();
+    if (ring.updateFile(slot, fd) < 0) {
+        return -1;
+    }
+    free_slots.pop_back();
+    return slot;
+}
+
+void UringEngine::unregisterFile(int slot) {
+    if (slot < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(files_lock);
+    ring.updateFile(slot, -1);
+    free_slots.push_back(slot);
+}
+
+void UringEngine::prepare(io_uring_sqe* sqe, int op, int fd, int slot, const void* buffer,
+                          size_t size, off_t offset, UringCompletion* completion) {
+    sqe->opcode = op;
+    if (slot >= 0) {
+        sqe->fd = slot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = fd;
+    }
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = reinterpret_cast<uint64_t>(completion);
+}
+
+// Helper function to queue one operation and submit it right away. Every
+// submit empties the queue, taken or withdrawn, so there is always room.
+// Returns true only if the kernel took it; otherwise nothing will complete.
+bool UringEngine::submitOne(int op, int fd, int slot, const void* buffer, size_t size, off_t offset,
+                            UringCompletion* completion, int buf_index) {
+    std::lock_guard<std::mutex> lock(submit_lock);
+    io_uring_sqe* sqe = ring.getSqe();
+    if (!sqe) {
+        std::cerr << "io_uring submission queue is full" << std::endl;
+        return false;
+    }
+    prepare(sqe, op, fd, slot, buffer, size, offset, completion);
+    if (buf_index >= 0) {
+        sqe->buf_index = buf_index;
+    }
+    int ret = ring.submit();
+    if (ret < 0) {
+        std::cerr << "io_uring submit failed: " << std::strerror(-ret) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Helper function to run one read or write to completion, resubmitting short transfers
+bool UringEngine::submitAndWait(int op, int fd, int slot, const void* buffer, size_t size, off_t offset) {
+    const char* data = static_cast<const char*>(buffer);
+    UringCompletion completion;
+    while (size > 0) {
+        completion.reset();
+        if (!submitOne(op, fd, slot, data, size, offset, &completion)) {
+            return false;
+        }
+        int res = completion.wait();
+        if (res == -EINTR || res == -EAGAIN) {
+            continue;
+        }
+        if (res <= 0) {
+            return false;
+        }
+        data += res;
+        size -= res;
+        offset += res;
+    }
+    return true;
+}
+
+bool UringEngine::read(int fd, int slot, void* buffer, size_t size, off_t offset) {
+    return submitAndWait(IORING_OP_READ, fd, slot, buffer, size, offset);
+}
+
+bool UringEngine::write(int fd, int slot, const void* buffer, size_t size, off_t offset) {
+    return submitAndWait(IORING_OP_WRITE, fd, slot, buffer, size, offset);
+}
+
+ssize_t UringEngine::readv(int fd, int slot, const struct iovec* buffers, int count, off_t offset) {
+    UringCompletion completion;
+    if (!submitOne(IORING_OP_READV, fd, slot, buffers, count, offset, &completion)) {
+        return -EIO;
+    }
+    return completion.wait();
+}
+
+// Helper function to take a registered buffer, optionally waiting for one to be returned
+int UringEngine::acquireBuffer(bool wait) {
+    std::unique_lock<std::mutex> lock(buffers_lock);
+    if (wait) {
+        buffers_cv.wait(lock, [this] { return !free_buffers.empty(); });
+    } else if (free_buffers.empty()) {
+        return -1;
+    }
+    int index = free_buffers.back();
+    free_buffers.pop_back();
+    return index;
+}
+
+void UringEngine::releaseBuffer(int index) {
+    std::lock_guard<std::mutex> lock(buffers_lock);
+    free_buffers.push_back(index);
+    buffers_cv.notify_one();
+}
+
+/**
+ * @brief Reads a byte range in GET_CHUNK_SIZE chunks into registered
+ *        buffers. Up to GET_PIPELINE_DEPTH chunks are in flight at once, so
+ *        while on_chunk sends one chunk the next is already being read;
+ *        each buffer is resubmitted for a later chunk right after it has
+ *        been handed over, which keeps the memory of a read fixed.
+ *
+ * @param fd        - File to read.
+ * @param slot      - Its fixed file slot, or -1.
+ * @param offset    - Where the range starts.
+ * @param size      - Length of the range.
+ * @param on_chunk  - Called with each chunk in order, from the calling thread.
+ * @return true if the whole range was read; false otherwise
+ */
+bool UringEngine::readChunks(int fd, int slot, off_t offset, size_t size, const ChunkCallback& on_chunk) {
+    size_t num_chunks = (size + GET_CHUNK_SIZE - 1) / GET_CHUNK_SIZE;
+    if (num_chunks == 0) {
+        return true;
+    }
+
+    // Wait for one buffer, take more for read-ahead only if they are free
+    std::vector<int> held{acquireBuffer(true)};
+    while (held.size() < std::min(GET_PIPELINE_DEPTH, num_chunks)) {
+        int index = acquireBuffer(false);
+        if (index == -1) {
+            break;
+        }
+        held.push_back(index);
+    }
+    size_t depth = held.size();
+    std::vector<UringCompletion> completions(depth);
+
+    auto chunkSize = [&](size_t chunk) {
+        return std::min(GET_CHUNK_SIZE, size - chunk * GET_CHUNK_SIZE);
+    };
+    auto queueChunk = [&](size_t chunk) {
+        int index = held[chunk % depth];
+        return submitOne(IORING_OP_READ_FIXED, fd, slot, buffers[index], chunkSize(chunk),
+                         offset + chunk * GET_CHUNK_SIZE, &completions[chunk % depth], index);
+    };
+
+    // Only reads the kernel took count as submitted
+    size_t submitted = 0;
+    bool success = true;
+    while (success && submitted < depth) {
+        success = queueChunk(submitted);
+        if (success) {
+            submitted++;
+        }
+    }
+
+    // Every submitted read is waited for, even after a failure, since the
+    // kernel may still be writing into its buffer
+    for (size_t chunk = 0; chunk < submitted; chunk++) {
+        UringCompletion& completion = completions[chunk % depth];
+        int res = completion.wait();
+        char* data = buffers[held[chunk % depth]];
+        size_t want = chunkSize(chunk);
+
+        if (success && res >= 0 && static_cast<size_t>(res) < want) {
+            // Short read, fetch the rest of the chunk directly
+            success = read(fd, slot, data + res, want - res, offset + chunk * GET_CHUNK_SIZE + res);
+        } else if (res < 0) {
+            success = false;
+        }
+        if (success) {
+            on_chunk(data, want);
+        }
+
+        completion.reset();
+        if (success && submitted < num_chunks) {
+            success = queueChunk(submitted);
+            if (success) {
+                submitted++;
+            }
+        }
+    }
+
+    for (int index : held) {
+        releaseBuffer(index);
+    }
+    return success;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file hearty-store-uring.hpp
+ * @author Nathadon Samairat
+ * @brief io_uring storage engine. Store files are registered as fixed files,
+ *        large reads land in registered buffers, and a Get keeps its next
+ *        chunk read in flight while the current one is being sent.
+ *        The rings are driven with the raw system calls, no liburing needed.
+ * @version 0.1
+ * @date 2024-12-12
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_URING_HPP
+#define HEARTY_STORE_URING_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+// The kernel header stays out of here, it defines a BLOCK_SIZE macro
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct iovec;
+
+const unsigned URING_QUEUE_DEPTH = 256;     // Submission queue entries
+const size_t URING_NUM_BUFFERS = 64;        // Registered GET_CHUNK_SIZE buffers shared by all reads
+const unsigned URING_MAX_FILES = 1024;      // Fixed file table slots
+const int URING_SUBMIT_RETRIES = 1000;      // Tries of a submit the kernel is too busy for, 100us apart
+
+// Result of one submitted operation, filled in by the completion thread
+struct UringCompletion {
+    std::mutex lock;
+    std::condition_variable done_cv;
+    bool done = false;
+    int result = 0;
+
+    void set(int res);
+    int wait();
+    void reset() { done = false; result = 0; }
+};
+
+// One submission and completion ring pair. Not thread safe, UringEngine
+// serializes submissions and reaps completions from a single thread.
+class IoUring {
+private:
+    int ring_fd = -1;
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_map_size = 0;
+    size_t cq_map_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_map_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0;      // SQEs handed out but not yet published
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool init(unsigned entries);
+    io_uring_sqe* getSqe();
+    int submit();
+    void withdraw();
+    int waitCompletions();
+    template <typename Handler>
+    void drainCompletions(Handler&& handle);
+
+    int registerBuffers(const std::vector<struct iovec>& buffers);
+    int registerFiles(const std::vector<int>& fds);
+    int updateFile(unsigned slot, int fd);
+};
+
+class UringEngine {
+public:
+    // Receives each chunk of a chunked read, in file order
+    using ChunkCallback = std::function<void(const char* data, size_t size)>;
+
+    static bool start();
+    static UringEngine* active();
+
+    ~UringEngine();
+
+    int registerFile(int fd);
+    void unregisterFile(int slot);
+
+    bool read(int fd, int slot, void* buffer, size_t size, off_t offset);
+    bool write(int fd, int slot, const void* buffer, size_t size, off_t offset);
+    bool readChunks(int fd, int slot, off_t offset, size_t size, const ChunkCallback& on_chunk);
+    // One vectored read, returns the bytes read or a negative errno
+    ssize_t readv(int fd, int slot, const struct iovec* buffers, int count, off_t offset);
+
+private:
+    IoUring ring;
+    std::mutex submit_lock;             // Guards the submission queue
+    std::thread reaper;                 // Completes operations as the kernel posts them
+    std::atomic<bool> stopping{false};
+
+    std::mutex files_lock;
+    std::vector<int> free_slots;        // Unused fixed file slots
+
+    std::mutex buffers_lock;
+    std::condition_variable buffers_cv;
+    std::vector<char*> buffers;         // Registered buffers, GET_CHUNK_SIZE each
+    std::vector<int> free_buffers;
+
+    UringEngine() = default;
+    bool init();
+    void reapLoop();
+
+    void prepare(io_uring_sqe* sqe, int op, int fd, int slot, const void* buffer,
+                 size_t size, off_t offset, UringCompletion* completion);
+    bool submitOne(int op, int fd, int slot, const void* buffer, size_t size, off_t offset,
+                   UringCompletion* completion, int buf_index = -1);
+    bool submitAndWait(int op, int fd, int slot, const void* buffer, size_t size, off_t offset);
+    int acquireBuffer(bool wait);
+    void releaseBuffer(int index);
+};
+
+#endif // HEARTY_STORE_URING_HPP
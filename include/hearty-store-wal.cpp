@@ -0,0 +1,530 @@
+/**
+ * @file hearty-store-wal.cpp
+ * @author Nathadon Samairat
+ * @brief Encoding, appending, replaying and recycling binary log records.
+ * @version 0.1
+ * @date 2024-12-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "hearty-store-wal.hpp"
+#include "hearty-store-crc32c.hpp"
+#include "hearty-store-files.hpp"
+#include "hearty-store-registry.hpp"
+
+// Helper function to append a fixed size field to an encoded record
+template <typename T>
+static void putField(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Helper function to take a fixed size field off the front of a payload
+template <typename T>
+static bool takeField(std::string_view& payload, T& value) {
+    if (payload.size() < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, payload.data(), sizeof(value));
+    payload.remove_prefix(sizeof(value));
+    return true;
+}
+
+// Helper function to take a length prefixed string off the front of a payload
+static bool takeString(std::string_view& payload, std::string_view& value) {
+    uint32_t length;
+    if (!takeField(payload, length) || payload.size() < length) {
+        return false;
+    }
+    value = payload.substr(0, length);
+    payload.remove_prefix(length);
+    return true;
+}
+
+// Helper function to checksum a record the way the reader checks it
+static uint32_t recordCrc(const LogRecordHeader& header, std::string_view head, std::string_view tail) {
+    uint32_t crc = crc32c(0, &header.length, sizeof(header.length) + sizeof(header.type));
+    crc = crc32c(crc, head.data(), head.size());
+    return crc32c(crc, tail.data(), tail.size());
+}
+
+// Helper function to append the encoded form of an entry to a buffer
+static void encodeLogRecord(const LogEntry& entry, std::string& out) {
+    // The small fields go in front, the one large field follows them
+    std::string head;
+    std::string_view tail;
+    std::string replaced;
+    switch (entry.type) {
+        case LogEntry::ALLOCATE:
+            putField<int32_t>(head, entry.block_index);
+            break;
+        case LogEntry::PUT_FILE:
+            putField<int32_t>(head, entry.block_index);
+            putField<uint32_t>(head, entry.checksum.size());
+            head += entry.checksum;
+            tail = entry.old_block_data;
+            break;
+        case LogEntry::ADD_ENTRY:
+            putField<int32_t>(head, entry.block_index);
+            putField<uint64_t>(head, entry.data_size);
+            putField<uint32_t>(head, entry.object_id.size());
+            head += entry.object_id;
+            putField<uint32_t>(head, entry.file_path.size());
+            head += entry.file_path;
+            for (const auto& [record, block] : entry.replaced_records) {
+                putField<int32_t>(replaced, record);
+                replaced.append(reinterpret_cast<const char*>(&block), sizeof(block));
+            }
+            tail = replaced;
+            break;
+        case LogEntry::COMMIT:
+            break;
+    }
+
+    LogRecordHeader header;
+    header.magic = LOG_RECORD_MAGIC;
+    header.length = head.size() + tail.size();
+    header.type = entry.type;
+    header.crc = recordCrc(header, head, tail);
+
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out += head;
+    out += tail;
+}
+
+// Helper function to append a whole buffer to a file opened with O_APPEND
+static bool writeAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+std::chrono::microseconds GroupCommitLog::max_delay{0};
+
+bool GroupCommitLog::open(int id, const StoreFiles& store_files) {
+    close();
+    store_id = id;
+    files = &store_files;
+
+    // Segments left by an earlier run are replayed and then recycled
+    closed.clear();
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(utils::getStorePath(store_id), error)) {
+        // Other files, stray ones included, are none of the log's business
+        uint64_t number;
+        if (utils::parseSegmentName("/" + entry.path().filename().string(), LOG_PREFIX, LOG_SUFFIX, number)) {
+            closed.push_back({number, 0});
+        }
+    }
+    if (error) {
+        std::cerr << "Failed to list the log of store " << store_id << ": " << error.message() << std::endl;
+        return false;
+    }
+    std::sort(closed.begin(), closed.end(), [](const Segment& a, const Segment& b) { return a.number < b.number; });
+
+    segment = closed.empty() ? 1 : closed.back().number + 1;
+    segment_bytes = 0;
+    return true;
+}
+
+void GroupCommitLog::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+uint64_t GroupCommitLog::append(const LogEntry& entry) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t before = pending.size();
+    encodeLogRecord(entry, pending);
+    appended += pending.size() - before;
+    if (entry.type == LogEntry::COMMIT) {
+        committed = appended;
+    }
+    if (pending.size() >= GROUP_COMMIT_MAX_BYTES) {
+        group_cv.notify_one();
+    }
+    return appended;
+}
+
+// Writes the buffered records to the current segment, write_lock must be held
+bool GroupCommitLog::writePending() {
+    std::string records;
+    uint64_t written_to;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        records.swap(pending);
+        written_to = appended;
+    }
+    if (records.empty()) {
+        return true;
+    }
+
+    if (fd < 0) {
+        std::string path = utils::getLogPath(store_id, segment);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "Failed to open log " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if (!writeAll(fd, records)) {
+        std::cerr << "Failed to append to log: " << strerror(errno) << std::endl;
+        return false;
+    }
+    segment_bytes += records.size();
+
+    std::lock_guard<std::mutex> guard(lock);
+    written = written_to;
+    return true;
+}
+
+bool GroupCommitLog::writeOut() {
+    std::lock_guard<std::mutex> writing(write_lock);
+    return writePending();
+}
+
+// Makes everything appended so far durable
+bool GroupCommitLog::flush() {
+    std::lock_guard<std::mutex> writing(write_lock);
+    if (!writePending()) {
+        return false;
+    }
+
+    uint64_t target;
+    uint64_t target_commit;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        target = written;
+        target_commit = std::min(committed, written);
+    }
+
+    // The content must reach the disk before the COMMIT records that vouch for it
+    if (!files->sync() || (fd >= 0 && fdatasync(fd) != 0)) {
+        std::cerr << "Failed to sync log: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        durable = std::max(durable, target);
+        durable_commit = std::max(durable_commit, target_commit);
+    }
+
+    // A full segment is closed, the next write starts the next one
+    if (segment_bytes >= LOG_SEGMENT_SIZE) {
+        close();
+        closed.push_back({segment, target});
+        segment++;
+        segment_bytes = 0;
+    }
+    return true;
+}
+
+uint64_t GroupCommitLog::durablePosition() {
+    std::lock_guard<std::mutex> guard(lock);
+    return durable;
+}
+
+bool GroupCommitLog::sync(uint64_t position) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (durable < position) {
+        if (leading) {
+            // Ride along with the group being synced, or lead the next one
+            synced_cv.wait(guard);
+            continue;
+        }
+
+        leading = true;
+        if (max_delay.count() > 0) {
+            group_cv.wait_for(guard, max_delay, [this] { return pending.size() >= GROUP_COMMIT_MAX_BYTES; });
+        }
+        guard.unlock();
+        bool success = flush();
+        guard.lock();
+        leading = false;
+        synced_cv.notify_all();
+        if (!success) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GroupCommitLog::sync() {
+    uint64_t position;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        position = appended;
+    }
+    return sync(position);
+}
+
+std::unique_lock<std::mutex> GroupCommitLog::hold() {
+    std::unique_lock<std::mutex> writing(write_lock);
+    writePending();
+    return writing;
+}
+
+std::vector<std::string> GroupCommitLog::segmentPaths() const {
+    std::vector<std::string> paths;
+    for (const Segment& closed_segment : closed) {
+        paths.push_back(utils::getLogPath(store_id, closed_segment.number));
+    }
+    if (fd >= 0) {
+        paths.push_back(utils::getLogPath(store_id, segment));
+    }
+    return paths;
+}
+
+bool GroupCommitLog::checkpoint() {
+    if (!sync()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> writing(write_lock);
+    uint64_t safe;
+    bool all_committed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        safe = durable_commit;
+        all_committed = written == durable_commit;
+    }
+
+    // Transactions in a segment that ends before the last durable COMMIT are
+    // finished, and so is everything they wrote
+    size_t recycled = 0;
+    while (recycled < closed.size() && closed[recycled].end <= safe) {
+        std::string path = utils::getLogPath(store_id, closed[recycled].number);
+        if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+            std::cerr << "Failed to recycle log segment " << path << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        recycled++;
+    }
+    closed.erase(closed.begin(), closed.begin() + recycled);
+
+    // Records appended since are still in the buffer, not in the file
+    if (all_committed && segment_bytes > 0 && fd >= 0) {
+        if (ftruncate(fd, 0) != 0) {
+            std::cerr << "Failed to recycle log segment: " << strerror(errno) << std::endl;
+            return false;
+        }
+        segment_bytes = 0;
+    }
+    return true;
+}
+
+// Helper function to put the old content back into a block without logging it
+static void restoreBlock(int block_num, std::string_view old_data, const StoreFiles& files) {
+    files.writeData(old_data.data(), std::min(old_data.size(), BLOCK_SIZE),
+                    static_cast<off_t>(block_num) * BLOCK_SIZE);
+}
+
+// Helper function to undo the transaction the log does not show as committed,
+// returns whether there was one
+static bool rollBackUncommitted(StoreState& store) {
+    // The segments are read as they are on disk, nothing is appended to them meanwhile
+    std::unique_lock<std::mutex> held = store.log.hold();
+    std::vector<std::unique_ptr<LogReader>> segments;
+    std::vector<LogRecordView> uncommitted_entries;
+    for (const std::string& path : store.log.segmentPaths()) {
+        auto log = std::make_unique<LogReader>();
+        if (!log->open(path)) {
+            continue;
+        }
+
+        // Records are read in place from the mapped segment until the last intact one
+        LogRecordView record;
+        while (log->next(record)) {
+            if (record.type == LogEntry::COMMIT) {
+                uncommitted_entries.clear();
+                continue;
+            }
+            uncommitted_entries.push_back(record);
+        }
+        if (log->validSize() < log->fileSize()) {
+            // An append was cut short, its record never took effect
+            std::cout << "Ignoring torn log tail of " << log->fileSize() - log->validSize()
+                      << " bytes in " << path << std::endl;
+        }
+        segments.push_back(std::move(log));
+    }
+
+    // If we didn't find a commit, we need to rollback changes
+    std::cout << "Uncommitted entries: " << uncommitted_entries.size() << std::endl;
+    if (uncommitted_entries.empty()) {
+        return false;
+    }
+
+    // Roll back the resident metadata, then write it through
+    std::vector<int> changed;
+    for (auto it = uncommitted_entries.rbegin(); it != uncommitted_entries.rend(); ++it) {
+        if (it->block_index < 0 || static_cast<size_t>(it->block_index) >= store.blocks.size()) {
+            continue;
+        }
+        BlockMetadata& block = store.blocks[it->block_index];
+        // Rollback each operation
+        switch(it->type) {
+            case LogEntry::ALLOCATE:
+                // Space no object record reaches is freed when the indexes are rebuilt
+                std::cout << "Releasing space allocated at " << it->block_index << std::endl;
+                break;
+            case LogEntry::PUT_FILE:
+                // Restore old block data, only logs of in-place overwrites hold any
+                std::cout << "Restoring old block data of block " << it->block_index << std::endl;
+                restoreBlock(it->block_index, it->old_block_data, store.files);
+                break;
+            case LogEntry::ADD_ENTRY:
+                // Remove metadata entry if it made it to the metadata
+                std::cout << "Removing metadata entry for " << it->file_path << std::endl;
+                if (std::string_view(block.object_id, strnlen(block.object_id, sizeof(block.object_id)))
+                        == it->object_id) {
+                    block = BlockMetadata{};
+                    changed.push_back(it->block_index);
+                }
+                // Bring back the object it replaced, its space was never reused
+                for (std::string_view replaced = it->replaced_records; !replaced.empty();
+                     replaced.remove_prefix(REPLACED_RECORD_SIZE)) {
+                    int32_t record;
+                    memcpy(&record, replaced.data(), sizeof(record));
+                    if (record < 0 || static_cast<size_t>(record) >= store.blocks.size()) {
+                        continue;
+                    }
+                    memcpy(&store.blocks[record], replaced.data() + sizeof(record), sizeof(BlockMetadata));
+                    changed.push_back(record);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    // The records were written out by hold(), saving writes them out again
+    held.unlock();
+    buildIndexes(store);
+    saveBlockMetadata(store, changed);
+    return true;
+}
+
+/**
+ * @brief Rolls back the transaction a store's log shows as unfinished,
+ *        makes the rollback durable and recycles the replayed segments. The store must not be used by anyone
+ *        else meanwhile: it is either being loaded or exclusively locked.
+ *
+ * @param store - The store to recover.
+ * @return true if there was something to roll back; false otherwise
+ */
+bool replayLog(StoreState& store) {
+    bool rolled_back = rollBackUncommitted(store);
+    if (rolled_back) {
+        // The rollback is final once it is on disk
+        LogEntry commit_entry{.type = LogEntry::COMMIT};
+        store.log.append(commit_entry);
+    }
+
+    // Nothing in the replayed segments is needed any more
+    store.log.checkpoint();
+    return rolled_back;
+}
+
+LogReader::~LogReader() {
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+bool LogReader::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Failed to map log " << path << std::endl;
+        return false;
+    }
+
+    data = static_cast<const char*>(addr);
+    size = st.st_size;
+    offset = 0;
+    return true;
+}
+
+bool LogReader::next(LogRecordView& record) {
+    // The header and the payload it announces must both be there
+    LogRecordHeader header;
+    if (size - offset < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data + offset, sizeof(header));
+    if (header.magic != LOG_RECORD_MAGIC || header.length > size - offset - sizeof(header)) {
+        return false;
+    }
+
+    std::string_view payload(data + offset + sizeof(header), header.length);
+    if (recordCrc(header, payload, std::string_view()) != header.crc) {
+        return false;
+    }
+
+    record = LogRecordView{};
+    record.type = static_cast<LogEntry::LogType>(header.type);
+    int32_t block = -1;
+    uint64_t data_size = 0;
+    bool valid = true;
+    switch (record.type) {
+        case LogEntry::ALLOCATE:
+            valid = takeField(payload, block);
+            break;
+        case LogEntry::PUT_FILE:
+            valid = takeField(payload, block) && takeString(payload, record.checksum);
+            record.old_block_data = payload;
+            break;
+        case LogEntry::ADD_ENTRY:
+            valid = takeField(payload, block) && takeField(payload, data_size) &&
+                    takeString(payload, record.object_id) && takeString(payload, record.file_path) &&
+                    payload.size() % REPLACED_RECORD_SIZE == 0;
+            record.replaced_records = payload;
+            break;
+        case LogEntry::COMMIT:
+            break;
+        default:
+            valid = false;
+            break;
+    }
+    if (!valid) {
+        return false;
+    }
+
+    record.block_index = block;
+    record.data_size = data_size;
+    offset += sizeof(header) + header.length;
+    return true;
+}
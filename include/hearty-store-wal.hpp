@@ -0,0 +1,182 @@
+/**
+ * @file hearty-store-wal.hpp
+ * @author Nathadon Samairat
+ * @brief Binary write-ahead log of a store. Every record is a fixed header
+ *        (magic, CRC32C, payload length, type) followed by its payload, so
+ *        raw block data is logged as is. Replay maps the log and walks the
+ *        records in place; the first record that is cut short or fails its
+ *        checksum is the torn tail of an interrupted append, and it and
+ *        everything after it are ignored. Appends go through a group commit
+ *        writer that makes the records of many Puts durable with a single
+ *        fdatasync. The log is a series of segment files in the store
+ *        directory; a checkpoint deletes the segments that only hold
+ *        durable, committed transactions.
+ * @version 0.1
+ * @date 2024-12-16
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef HEARTY_STORE_WAL_HPP
+#define HEARTY_STORE_WAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "hearty-store-server.hpp"
+
+class StoreFiles;
+struct StoreState;
+
+const uint32_t LOG_RECORD_MAGIC = 0x484C4F47;   // "GOLH" on disk
+const size_t GROUP_COMMIT_MAX_BYTES = 4 * 1024 * 1024;  // Pending bytes that end a leader's wait early
+const size_t LOG_SEGMENT_SIZE = 16 * 1024 * 1024;       // A segment is closed once it grows past this
+
+struct LogRecordHeader {
+    uint32_t magic;
+    uint32_t crc;           // CRC32C of length, type and the payload
+    uint32_t length;        // Payload bytes after the header
+    uint32_t type;          // A LogEntry::LogType
+};
+
+// Payloads by type, all integers in host byte order:
+//   ALLOCATE   int32 block
+//   PUT_FILE   int32 block, uint32 checksum length, checksum, old block data
+//   ADD_ENTRY  int32 block, uint64 data size, uint32 object id length, object id,
+//              uint32 file path length, file path, then per replaced record
+//              int32 record and its BlockMetadata
+//   COMMIT     empty
+
+// A record as it lies in the mapped log, the views point into the mapping
+struct LogRecordView {
+    LogEntry::LogType type;
+    int block_index = -1;
+    size_t data_size = 0;
+    std::string_view checksum;
+    std::string_view old_block_data;
+    std::string_view object_id;
+    std::string_view file_path;
+    std::string_view replaced_records;  // ADD_ENTRY: the packed records of the replaced object
+};
+
+const size_t REPLACED_RECORD_SIZE = sizeof(int32_t) + sizeof(BlockMetadata);
+
+/**
+ * @brief Read-only mapping of a log, decoded one record at a time.
+ */
+class LogReader {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;      // End of the last intact record
+
+public:
+    LogReader() = default;
+    ~LogReader();
+
+    LogReader(const LogReader&) = delete;
+    LogReader& operator=(const LogReader&) = delete;
+
+    // Maps the log, false if there is none or it is empty
+    bool open(const std::string& path);
+
+    // Decodes the next record, false at the end of the log or at a torn tail
+    bool next(LogRecordView& record);
+
+    size_t validSize() const { return offset; }
+    size_t fileSize() const { return size; }
+};
+
+/**
+ * @brief Group commit writer of a store's log.
+ *
+ * Records are appended to an in-memory buffer. A Put that needs its records
+ * on disk calls sync(); the first caller becomes the leader, optionally waits
+ * up to the maximum batch delay for more commits to join, then writes the
+ * whole buffer, fdatasyncs the store files and the log once, and wakes every
+ * caller whose records that covered. Callers arriving meanwhile wait for the
+ * leader or lead the next group.
+ *
+ * Positions count every byte appended since the log was opened. Segments
+ * found at open come from an earlier run and end at position 0.
+ */
+class GroupCommitLog {
+private:
+    struct Segment {
+        uint64_t number;
+        uint64_t end;               // Log position after its last record
+    };
+
+    std::mutex lock;                // Guards the buffer and the positions
+    std::mutex write_lock;          // Keeps writes to the file in log order, guards the segments
+    std::condition_variable synced_cv;
+    std::condition_variable group_cv;   // Tells a waiting leader the group is full
+    int store_id = -1;
+    int fd = -1;                    // Segment appended to, created on the first write
+    uint64_t segment = 0;           // Number of that segment
+    size_t segment_bytes = 0;
+    std::vector<Segment> closed;    // Segments no longer appended to, oldest first
+    const StoreFiles* files = nullptr;
+    std::string pending;            // Encoded records not written yet
+    uint64_t appended = 0;
+    uint64_t written = 0;           // Everything before this is in the files
+    uint64_t committed = 0;         // Position after the last COMMIT record
+    uint64_t durable = 0;           // Everything before this is on disk
+    uint64_t durable_commit = 0;    // Position after the last COMMIT record on disk
+    bool leading = false;           // A leader is gathering or syncing a group
+
+    static std::chrono::microseconds max_delay;
+
+    bool writePending();
+    bool flush();
+
+public:
+    GroupCommitLog() = default;
+    ~GroupCommitLog() { close(); }
+
+    GroupCommitLog(const GroupCommitLog&) = delete;
+    GroupCommitLog& operator=(const GroupCommitLog&) = delete;
+
+    // Longest a leader waits for more commits before it syncs, 0 syncs right away
+    static void setMaxDelay(std::chrono::microseconds delay) { max_delay = delay; }
+
+    // Finds the segments of a store, new records go to a segment of their own.
+    // The files are synced along with the log.
+    bool open(int store_id, const StoreFiles& store_files);
+    void close();
+
+    // Buffers a record, returns the log position after it
+    uint64_t append(const LogEntry& entry);
+
+    // Writes the buffered records to the log without syncing them. Called
+    // before metadata.bin is written, so no change reaches it ahead of the
+    // record that undoes it.
+    bool writeOut();
+
+    // Log position up to which everything is on disk
+    uint64_t durablePosition();
+
+    // Waits until everything up to position is durable, false if a sync failed
+    bool sync(uint64_t position);
+    bool sync();
+
+    // Writes the buffered records out and keeps further writes away, so the
+    // segments can be read as they are while the returned lock is held
+    std::unique_lock<std::mutex> hold();
+
+    // Paths of the segments, oldest first. Call while holding the log.
+    std::vector<std::string> segmentPaths() const;
+
+    // Makes everything logged so far durable, then deletes the segments that
+    // only hold committed transactions and empties the current one if it does
+    bool checkpoint();
+};
+
+bool replayLog(StoreState& store);
+
+#endif // HEARTY_STORE_WAL_HPP
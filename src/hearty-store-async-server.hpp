@@ -0,0 +1,566 @@
+/**
+ * @file hearty-store-async-server.hpp
+ * @author Nathadon Samairat
+ * @brief Asynchronous (completion queue based) front end of the hearty store server.
+ *        A few polling threads drive every open call, while the blocking disk
+ *        work runs on a separate I/O thread pool, so open streams no longer
+ *        cost one thread each. Get is served as a raw method: its responses
+ *        are framed by hand around slices of the mapped data file, so the
+ *        object is never copied in user space.
+ * @version 0.1
+ * @date 2024-12-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <proto/hearty-store.grpc.pb.h>
+#include <proto/hearty-store.pb.h>
+#include "../include/hearty-store-files.hpp"
+#include "../include/hearty-store-thread-pool.hpp"
+#include "hearty-store-handler.hpp"
+
+/**
+ * @brief A call in flight on a completion queue. The call object is its own tag.
+ */
+class AsyncCall {
+public:
+    virtual ~AsyncCall() = default;
+    virtual void proceed(bool ok) = 0;
+};
+
+/**
+ * @brief The generated async service with Get switched to raw byte buffers,
+ *        so its responses can be built from slices the server does not own.
+ */
+class HeartyAsyncService : public ProcessingService::AsyncService {
+public:
+    static const int GET_METHOD = 2;    // Position of Get in the service definition
+
+    HeartyAsyncService() { grpc::Service::MarkMethodRaw(GET_METHOD); }
+
+    void RequestRawGet(grpc::ServerContext* context, grpc::ByteBuffer* request,
+                       grpc::ServerAsyncWriter<grpc::ByteBuffer>* writer,
+                       grpc::CompletionQueue* new_call_cq,
+                       grpc::ServerCompletionQueue* notification_cq, void* tag) {
+        grpc::Service::RequestAsyncServerStreaming(GET_METHOD, context, request, writer,
+                                                   new_call_cq, notification_cq, tag);
+    }
+};
+
+// Everything a call needs to accept the next request and serve it
+struct AsyncContext {
+    HeartyAsyncService* service;
+    grpc::ServerCompletionQueue* cq;
+    RequestHandler* handler;
+    ThreadPool* io_pool;
+};
+
+/**
+ * @brief Serves one unary RPC. The handler runs on the I/O pool and the
+ *        response is sent back from there.
+ */
+template <class Request, class Response>
+class UnaryCall : public AsyncCall {
+public:
+    using RequestMethod = void (ProcessingService::AsyncService::*)(
+        grpc::ServerContext*, Request*, grpc::ServerAsyncResponseWriter<Response>*,
+        grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+    using Handle = std::function<grpc::Status(grpc::ServerContext&, const Request&, Response*)>;
+
+    UnaryCall(const AsyncContext& async, RequestMethod request_method, Handle handle)
+        : async(async), request_method(request_method), handle(std::move(handle)),
+          responder(&context) {
+        (async.service->*request_method)(&context, &request, &responder,
+                                         async.cq, async.cq, this);
+    }
+
+    void proceed(bool ok) override {
+        // Either the response went out or the server is shutting down
+        if (state == FINISH || !ok) {
+            delete this;
+            return;
+        }
+
+        // Keep a call waiting for the next request of this kind
+        new UnaryCall(async, request_method, handle);
+
+        state = FINISH;
+        async.io_pool->submit([this] {
+            grpc::Status status = handle(context, request, &response);
+            if (status.ok()) {
+                responder.Finish(response, status, this);
+            } else {
+                responder.FinishWithError(status, this);
+            }
+        });
+    }
+
+private:
+    enum State { PROCESS, FINISH };
+
+    AsyncContext async;
+    RequestMethod request_method;
+    Handle handle;
+    State state = PROCESS;
+    grpc::ServerContext context;
+    Request request;
+    Response response;
+    grpc::ServerAsyncResponseWriter<Response> responder;
+};
+
+/**
+ * @brief Serves one streamed Get. The object is looked up on the I/O pool,
+ *        then each chunk goes out as a serialized getResponse whose content
+ *        is a slice of the mapped data file. The next chunk is only framed
+ *        once the previous write completes, i.e. once flow control has taken
+ *        it, and it is prefetched meanwhile, so a stream holds two chunks at
+ *        most. Each block is checked against its checksum on the I/O pool
+ *        before its first chunk goes out. The slices share the lease on the object, which pins its
+ *        space until gRPC has sent the last one; the store itself is only
+ *        locked while the object is looked up. This holds with
+ *        --io-uring too: the chunks are read by faulting in the mapping, not
+ *        by io_uring reads, which would have to copy them into registered
+ *        buffers the slices could not point into. An object served from the
+ *        buffer pool is sent from pool blocks instead, fetched on the I/O
+ *        pool one at a time as the stream reaches them; each slice keeps its
+ *        own block alive.
+ */
+class GetCall : public AsyncCall {
+public:
+    explicit GetCall(const AsyncContext& async) : async(async), writer(&context) {
+        async.service->RequestRawGet(&context, &raw_request, &writer, async.cq, async.cq, this);
+    }
+
+    void proceed(bool ok) override {
+        switch (state) {
+            case PROCESS:
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+                new GetCall(async);
+                async.io_pool->submit([this] {
+                    ::getRequest request;
+                    ::getResponse failure;
+                    if (!grpc::SerializationTraits<::getRequest>::Deserialize(&raw_request, &request).ok()) {
+                        failure.set_success(false);
+                        failure.set_message("Malformed Get request");
+                    } else {
+                        file_identifier = request.file_identifier();
+                        lease = async.handler->GetMapped(request, &failure, &status);
+                    }
+                    if (lease) {
+                        position = lease->object.offset;
+                        checked = position;
+                    }
+
+                    if (!lease && status.ok()) {
+                        bool own_buffer;
+                        grpc::SerializationTraits<::getResponse>::Serialize(failure, &failure_response, &own_buffer);
+                        has_failure = true;
+                    }
+                    writeNext();
+                });
+                break;
+            case WRITE:
+                if (!ok) {
+                    // The client went away, nothing left to send
+                    lease.reset();
+                    state = FINISH;
+                    writer.Finish(grpc::Status::CANCELLED, this);
+                    return;
+                }
+                // A pool block that may have to be read, or a block to check, is
+                // handled off the completion queue
+                if (needsFetch()) {
+                    async.io_pool->submit([this] { writeNext(); });
+                } else {
+                    writeNext();
+                }
+                break;
+            case FINISH:
+                delete this;
+                break;
+        }
+    }
+
+private:
+    enum State { PROCESS, WRITE, FINISH };
+
+    AsyncContext async;
+    State state = PROCESS;
+    grpc::ServerContext context;
+    grpc::ByteBuffer raw_request;
+    grpc::ServerAsyncWriter<grpc::ByteBuffer> writer;
+    std::shared_ptr<MappedGet> lease;
+    size_t range = 0;           // Range of the object being sent
+    size_t range_done = 0;      // Bytes of that range already sent
+    ObjectPiece piece;          // Pool piece being sent
+    size_t piece_done = 0;      // Bytes of that piece already sent
+    uint64_t position = 0;      // Next byte of the object to fetch from the pool or send from the views
+    uint64_t checked = 0;       // The views may be sent up to this byte
+    std::string file_identifier;
+    bool fetch_failed = false;  // A block could not be read or checked after the stream started
+    bool sent_any = false;      // A response went out already
+    grpc::ByteBuffer failure_response;
+    bool has_failure = false;
+    grpc::Status status;        // Status the call ends with
+
+    // Helper function to drop the reference a slice holds on the memory it points into
+    static void releaseKeeper(void* keeper) {
+        delete static_cast<std::shared_ptr<const void>*>(keeper);
+    }
+
+    // Helper function to frame a piece of content as a serialized getResponse,
+    // keeper holds the memory the content lies in
+    static grpc::ByteBuffer mappedChunk(const std::shared_ptr<const void>& keeper,
+                                        const char* data, size_t size) {
+        using google::protobuf::internal::WireFormatLite;
+        uint8_t header[16];
+        uint8_t* end = WireFormatLite::WriteBoolToArray(::getResponse::kSuccessFieldNumber, true, header);
+        end = WireFormatLite::WriteTagToArray(::getResponse::kFileContentFieldNumber,
+                                              WireFormatLite::WIRETYPE_LENGTH_DELIMITED, end);
+        end = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(size, end);
+
+        grpc::Slice slices[2] = {
+            grpc::Slice(header, end - header),
+            grpc::Slice(const_cast<char*>(data), size, &releaseKeeper,
+                        new std::shared_ptr<const void>(keeper)),
+        };
+        return grpc::ByteBuffer(slices, 2);
+    }
+
+    // Helper function to tell whether the next chunk needs a pool piece fetched
+    // or a block of the views checked first
+    bool needsFetch() const {
+        if (!lease || position == lease->object.end) {
+            return false;
+        }
+        return lease->object.read_piece ? piece_done == piece.size : position >= checked;
+    }
+
+    // Helper function to find the chunk at the cursor, skipping used up
+    // ranges. Pool pieces are fetched as the cursor reaches them.
+    bool chunkAt(const char*& data, size_t& size, std::shared_ptr<const void>& keeper) {
+        MappedObject& object = lease->object;
+        if (object.read_piece) {
+            if (piece_done == piece.size) {
+                if (position == object.end) {
+                    return false;
+                }
+                if (!object.read_piece(position, piece)) {
+                    fetch_failed = true;
+                    return false;
+                }
+                position += piece.size;
+                piece_done = 0;
+            }
+            data = piece.data->data() + piece.from + piece_done;
+            size = std::min(piece.size - piece_done, GET_CHUNK_SIZE);
+            keeper = piece.data;
+            return true;
+        }
+
+        const auto& ranges = object.ranges;
+        while (range < ranges.size() && range_done >= ranges[range].second) {
+            range++;
+            range_done = 0;
+        }
+        if (range == ranges.size()) {
+            return false;
+        }
+        data = ranges[range].first + range_done;
+        size = std::min(ranges[range].second - range_done, GET_CHUNK_SIZE);
+        keeper = lease;
+        return true;
+    }
+
+    // Helper function to send the next chunk or close the stream
+    void writeNext() {
+        if (has_failure) {
+            has_failure = false;
+            state = WRITE;
+            writer.Write(failure_response, this);
+            return;
+        }
+
+        const char* data;
+        size_t size;
+        std::shared_ptr<const void> keeper;
+        bool has_chunk = lease && chunkAt(data, size, keeper);
+        if (has_chunk && !lease->object.read_piece) {
+            // A chunk never runs past the block checked last
+            if (position >= checked && !checkMappedBlock(file_identifier, lease->object, position, checked)) {
+                fetch_failed = true;
+            }
+            size = std::min<uint64_t>(size, checked - position);
+        }
+        if (fetch_failed) {
+            // The stream is cut short with a failed response, like a sync Get
+            ::getResponse failure;
+            failure.set_success(false);
+            failure.set_message("Failed to retrieve file with identifier " + file_identifier);
+            bool own_buffer;
+            grpc::SerializationTraits<::getResponse>::Serialize(failure, &failure_response, &own_buffer);
+            fetch_failed = false;
+            has_failure = true;
+            lease.reset();
+            writeNext();
+            return;
+        }
+        if (lease && !sent_any && !has_chunk) {
+            // An empty object or range still gets its one response
+            ::getResponse response;
+            response.set_success(true);
+            grpc::ByteBuffer empty;
+            bool own_buffer;
+            grpc::SerializationTraits<::getResponse>::Serialize(response, &empty, &own_buffer);
+            sent_any = true;
+            state = WRITE;
+            writer.Write(empty, this);
+            return;
+        }
+        if (!has_chunk) {
+            lease.reset();
+            state = FINISH;
+            writer.Finish(status, this);
+            return;
+        }
+        grpc::ByteBuffer chunk = mappedChunk(keeper, data, size);
+        if (lease->object.read_piece) {
+            piece_done += size;
+        } else {
+            range_done += size;
+            position += size;
+        }
+        sent_any = true;
+
+        // The kernel reads the next chunk in while this one is on the wire
+        const char* next;
+        size_t next_size;
+        std::shared_ptr<const void> next_keeper;
+        if (lease->object.mapping && chunkAt(next, next_size, next_keeper)) {
+            lease->object.mapping->prefetch(next, next_size);
+        }
+
+        state = WRITE;
+        writer.Write(chunk, this);
+    }
+};
+
+/**
+ * @brief Serves one streamed Put. Pieces are written to disk on the I/O
+ *        pool, one at a time and in order, while the next piece is already
+ *        being received. At most two pieces are held: reading pauses while
+ *        one is waiting behind the piece being written, which leaves the
+ *        rest to gRPC flow control.
+ */
+class PutStreamCall : public AsyncCall {
+public:
+    explicit PutStreamCall(const AsyncContext& async) : async(async), reader(&context) {
+        async.service->RequestPutStream(&context, &reader, async.cq, async.cq, this);
+    }
+
+    void proceed(bool ok) override {
+        switch (state) {
+            case PROCESS:
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+                new PutStreamCall(async);
+                state = READ;
+                reader.Read(&incoming, this);
+                break;
+            case READ: {
+                std::lock_guard<std::mutex> lock(pieces_lock);
+                if (!ok) {
+                    // The client sent its last piece
+                    reads_done = true;
+                    if (!writing) {
+                        async.io_pool->submit([this] { finish(); });
+                    }
+                    return;
+                }
+                pending.push_back(std::move(incoming));
+                if (writing) {
+                    read_paused = true;
+                } else {
+                    writing = true;
+                    reader.Read(&incoming, this);
+                    async.io_pool->submit([this] { writePieces(); });
+                }
+                break;
+            }
+            case FINISH:
+                delete this;
+                break;
+        }
+    }
+
+private:
+    enum State { PROCESS, READ, FINISH };
+
+    AsyncContext async;
+    State state = PROCESS;
+    grpc::ServerContext context;
+    grpc::ServerAsyncReader<::putResponse, ::putStreamRequest> reader;
+    ::putStreamRequest incoming;
+    PutStreamState put_state;
+
+    std::mutex pieces_lock;                 // Guards the fields below
+    std::deque<::putStreamRequest> pending; // Received, not yet written
+    bool writing = false;                   // A writePieces task is running
+    bool read_paused = false;               // No Read is outstanding
+    bool reads_done = false;                // The client has sent every piece
+
+    // Helper function to write the pending pieces in order, resuming reads as room frees up
+    void writePieces() {
+        for (;;) {
+            ::putStreamRequest piece;
+            {
+                std::lock_guard<std::mutex> lock(pieces_lock);
+                if (pending.empty()) {
+                    writing = false;
+                    if (!reads_done) {
+                        return;
+                    }
+                    break;
+                }
+                piece = std::move(pending.front());
+                pending.pop_front();
+                if (read_paused) {
+                    read_paused = false;
+                    reader.Read(&incoming, this);
+                }
+            }
+            async.handler->PutStreamPiece(put_state, piece);
+        }
+        finish();
+    }
+
+    // Helper function to commit the put and send the response
+    void finish() {
+        ::putResponse response;
+        grpc::Status status = async.handler->PutStreamFinish(put_state, &response);
+        state = FINISH;
+        if (status.ok()) {
+            reader.Finish(response, status, this);
+        } else {
+            reader.FinishWithError(status, this);
+        }
+    }
+};
+
+/**
+ * @brief Owns the completion queues, their polling threads and the I/O pool.
+ */
+class AsyncServer {
+private:
+    RequestHandler& handler;
+    size_t num_cq_threads;
+    ThreadPool io_pool;
+    HeartyAsyncService service;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs;
+    std::unique_ptr<grpc::Server> server;
+
+    // Helper function to put one call of every kind on a completion queue
+    void seedCalls(grpc::ServerCompletionQueue* cq) {
+        AsyncContext async{&service, cq, &handler, &io_pool};
+        using Service = ProcessingService::AsyncService;
+
+        new UnaryCall<::initRequest, ::initResponse>(async, &Service::RequestInit,
+            [this](grpc::ServerContext&, const ::initRequest& request, ::initResponse* response) {
+                return handler.Init(request, response);
+            });
+        new UnaryCall<::putRequest, ::putResponse>(async, &Service::RequestPut,
+            [this](grpc::ServerContext&, const ::putRequest& request, ::putResponse* response) {
+                return handler.Put(request, response);
+            });
+        new GetCall(async);
+        new PutStreamCall(async);
+        new UnaryCall<::batchPutRequest, ::batchPutResponse>(async, &Service::RequestBatchPut,
+            [this](grpc::ServerContext&, const ::batchPutRequest& request, ::batchPutResponse* response) {
+                return handler.BatchPut(request, response);
+            });
+        new UnaryCall<::batchGetRequest, ::batchGetResponse>(async, &Service::RequestBatchGet,
+            [this](grpc::ServerContext&, const ::batchGetRequest& request, ::batchGetResponse* response) {
+                return handler.BatchGet(request, response);
+            });
+        new UnaryCall<::listRequest, ::listResponse>(async, &Service::RequestList,
+            [this](grpc::ServerContext&, const ::listRequest& request, ::listResponse* response) {
+                handler.List(request, response);
+                return grpc::Status::OK;
+            });
+        new UnaryCall<::destroyRequest, ::destroyResponse>(async, &Service::RequestDestroy,
+            [this](grpc::ServerContext&, const ::destroyRequest& request, ::destroyResponse* response) {
+                return handler.Destroy(request, response);
+            });
+        new UnaryCall<::cacheRequest, ::cacheResponse>(async, &Service::RequestCache,
+            [this](grpc::ServerContext& context, const ::cacheRequest& request, ::cacheResponse* response) {
+                handler.Cache(context.peer(), request, response);
+                return grpc::Status::OK;
+            });
+        new UnaryCall<::evictRequest, ::evictResponse>(async, &Service::RequestEvict,
+            [this](grpc::ServerContext&, const ::evictRequest& request, ::evictResponse* response) {
+                handler.Evict(request, response);
+                return grpc::Status::OK;
+            });
+    }
+
+public:
+    AsyncServer(RequestHandler& handler, size_t num_cq_threads, size_t num_io_threads)
+        : handler(handler), num_cq_threads(num_cq_threads == 0 ? 1 : num_cq_threads),
+          io_pool(num_io_threads) {}
+
+    /**
+     * @brief Starts listening on the given address and serves until the server stops.
+     *
+     * @param address - Address and port to listen on.
+     */
+    void run(const std::string& address) {
+        grpc::ServerBuilder builder;
+        builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+        builder.SetMaxReceiveMessageSize(MAX_MESSAGE_SIZE);
+        builder.RegisterService(&service);
+        for (size_t i = 0; i < num_cq_threads; i++) {
+            cqs.push_back(builder.AddCompletionQueue());
+        }
+        server = builder.BuildAndStart();
+        std::cout << "Hearty store service (async, " << num_cq_threads << " polling threads, "
+                  << io_pool.size() << " I/O threads) is running on " << address << std::endl;
+
+        std::vector<std::thread> pollers;
+        for (auto& cq : cqs) {
+            seedCalls(cq.get());
+            pollers.emplace_back([queue = cq.get()] {
+                void* tag;
+                bool ok;
+                while (queue->Next(&tag, &ok)) {
+                    static_cast<AsyncCall*>(tag)->proceed(ok);
+                }
+            });
+        }
+
+        server->Wait();
+        for (auto& cq : cqs) {
+            cq->Shutdown();
+        }
+        for (auto& poller : pollers) {
+            poller.join();
+        }
+    }
+};
@@ -2,11 +2,13 @@
 #include <grpcpp/grpcpp.h>
 #include <proto/hearty-store.grpc.pb.h>
 #include <proto/hearty-store.pb.h>
+#include "hearty-store-common.hpp"
 #include <iostream>
 #include <queue>
 #include <unordered_map>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <ctime>
 
 // Cache entry structure
@@ -66,6 +68,21 @@ public:
         cache_map[file_id] = entry;
         fifo_queue.push(file_id);
     }
+
+    // Caches a file by copying it, without reading it into memory
+    void cacheFileFromPath(const std::string& store_id, const std::string& file_id,
+                           const std::string& file_path, ProcessingService::Stub* stub) {
+        evictIfNeeded(stub);
+
+        std::string cache_path = cache_dir + "/" + file_id;
+        std::error_code copy_error;
+        std::filesystem::copy_file(file_path, cache_path,
+                                   std::filesystem::copy_options::overwrite_existing, copy_error);
+
+        CacheEntry entry{store_id, file_id, file_path, false, std::time(nullptr)};
+        cache_map[file_id] = entry;
+        fifo_queue.push(file_id);
+    }
     
     bool isInCache(const std::string& file_id) {
         return cache_map.find(file_id) != cache_map.end();
@@ -82,16 +99,88 @@ public:
             cache_map.erase(file_id);
             std::filesystem::remove(cache_dir + "/" + file_id);
         }
+
+        // Ranges of the file are stale as well
+        std::string prefix = file_id + "@";
+        for (auto it = cache_map.begin(); it != cache_map.end();) {
+            if (it->first.compare(0, prefix.size(), prefix) == 0) {
+                std::filesystem::remove(cache_dir + "/" + it->first);
+                it = cache_map.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Cache key of a range of a file, the whole file is cached under its id
+    static std::string rangeKey(const std::string& file_id, uint64_t offset, uint64_t length) {
+        if (offset == 0 && length == 0) return file_id;
+        return file_id + "@" + std::to_string(offset) + "-" + std::to_string(length);
+    }
+
+    /**
+     * @brief Finds a cached copy holding the bytes [offset, offset + length)
+     *        of a file: the whole file, or a cached range around them.
+     *
+     * @param file_id   - ID of the file.
+     * @param offset    - First byte wanted.
+     * @param length    - Bytes wanted, 0 for everything up to the end.
+     * @param skip      - Set to where the wanted bytes start in the cached copy.
+     * @return The cache key of the copy, or an empty string if none holds them.
+     */
+    std::string findCachedRange(const std::string& file_id, uint64_t offset, uint64_t length,
+                                uint64_t& skip) {
+        if (isInCache(file_id)) {
+            skip = offset;
+            return file_id;
+        }
+
+        std::string prefix = file_id + "@";
+        for (const auto& entry : cache_map) {
+            const std::string& key = entry.first;
+            if (key.compare(0, prefix.size(), prefix) != 0) continue;
+
+            size_t dash = key.find('-', prefix.size());
+            uint64_t cached_offset = std::stoull(key.substr(prefix.size(), dash - prefix.size()));
+            uint64_t cached_length = std::stoull(key.substr(dash + 1));
+            if (cached_offset > offset) continue;
+
+            // Compared as distances from the cached offset, sums could overflow
+            uint64_t into = offset - cached_offset;
+            bool covers_end = cached_length == 0 ||
+                (length != 0 && into <= cached_length && length <= cached_length - into);
+            if (covers_end) {
+                skip = into;
+                return key;
+            }
+        }
+        return "";
+    }
+
+    // Reads length bytes (0 = to the end) of a cached copy, starting skip bytes in
+    std::string getRangeFromCache(const std::string& key, uint64_t skip, uint64_t length) {
+        std::ifstream cache_file(cache_dir + "/" + key, std::ios::binary);
+        cache_file.seekg(skip);
+        if (length == 0) {
+            return std::string((std::istreambuf_iterator<char>(cache_file)),
+                               std::istreambuf_iterator<char>());
+        }
+        std::string content(length, '\0');
+        cache_file.read(&content[0], length);
+        content.resize(cache_file.gcount());
+        return content;
     }
 
     std::string getFileFromServer(const std::string& store_id, const std::string& file_id, 
-                              ProcessingService::Stub* stub) {
+                              ProcessingService::Stub* stub, uint64_t offset = 0, uint64_t length = 0) {
         std::string accumulated_content = "";
         getRequest get_request;
         getResponse get_response;
         grpc::ClientContext get_context;
         get_request.set_store_name(store_id);
         get_request.set_file_identifier(file_id);
+        get_request.set_offset(offset);
+        get_request.set_length(length);
         grpc::Status get_status;
         std::unique_ptr<grpc::ClientReader<getResponse>> reader = stub->Get(&get_context, get_request);
         std::cout << "Client Get Sent:" << std::endl;
@@ -102,27 +191,48 @@ public:
         if (!get_status.ok()) {
             std::cerr << "Get failed: " << get_status.error_message() << std::endl;
         }
-        cacheFile(store_id, file_id, "", accumulated_content, stub);
+        cacheFile(store_id, rangeKey(file_id, offset, length), "", accumulated_content, stub);
         saveAllCachesToFile();
         return accumulated_content;
     }
 
     std::string putContentToServer(const std::string& store_id, const std::string& file_path, 
                                     std::string file_id, ProcessingService::Stub* stub) {
-        // Read file content
-        std::ifstream file(file_path);
-        std::string file_content((std::istreambuf_iterator<char>(file)),
-                                std::istreambuf_iterator<char>());
+        // Stream the file to the server in chunks, the first one names the
+        // store and the path and announces the size
+        std::ifstream file(file_path, std::ios::binary);
+        std::error_code size_error;
+        uintmax_t file_size = std::filesystem::file_size(file_path, size_error);
+        if (!file || size_error) {
+            std::cerr << "Failed to open " << file_path << std::endl;
+            return file_id;
+        }
 
-        // Write to the server
-        putRequest put_request;
         putResponse put_response;
         grpc::ClientContext put_context;
+        std::unique_ptr<grpc::ClientWriter<putStreamRequest>> writer =
+            stub->PutStream(&put_context, &put_response);
+        std::cout << "Client Put Sent:" << std::endl;
+
+        putStreamRequest put_request;
         put_request.set_store_name(store_id);
         put_request.set_file_path(file_path);
-        put_request.set_file_content(file_content);
-        std::cout << "Client Put Sent:" << std::endl;
-        grpc::Status put_status = stub->Put(&put_context, put_request, &put_response);
+        put_request.set_file_size(file_size);
+        std::string chunk(PUT_CHUNK_SIZE, '\0');
+        uintmax_t sent = 0;
+        do {
+            file.read(&chunk[0], std::min<uintmax_t>(PUT_CHUNK_SIZE, file_size - sent));
+            put_request.set_file_content(chunk.data(), file.gcount());
+            sent += file.gcount();
+            if (!writer->Write(put_request)) {
+                break;
+            }
+            put_request.clear_store_name();
+            put_request.clear_file_path();
+        } while (sent < file_size && file.gcount() > 0);
+        writer->WritesDone();
+
+        grpc::Status put_status = writer->Finish();
         if (!put_status.ok()) {
             std::cerr << "Put failed: " << put_status.error_message() << std::endl;
         } else {
@@ -130,7 +240,7 @@ public:
         }
 
         // Write to the cache
-        cacheFile(store_id, file_id, file_path, file_content, stub);
+        cacheFileFromPath(store_id, file_id, file_path, stub);
         saveAllCachesToFile();
         return file_id;
     }
@@ -162,7 +272,8 @@ public:
         file << fifo_queue.size() << std::endl;
         // Save cache map
         for (const auto& entry : cache_map) {
-            file << entry.first << " " << entry.second.file_path << " " << entry.second.is_dirty 
+            file << entry.second.store_id << " " << entry.first << " "
+                 << std::quoted(entry.second.file_path) << " " << entry.second.is_dirty
                  << " " << entry.second.timestamp << std::endl;
         }
         file.close();
@@ -185,7 +296,7 @@ public:
             bool is_dirty;
             std::string store_id;
             std::time_t timestamp;
-            file >> store_id >> file_id >> file_path >> is_dirty >> timestamp;
+            file >> store_id >> file_id >> std::quoted(file_path) >> is_dirty >> timestamp;
             cache_map[file_id] = CacheEntry{store_id, file_id, file_path, is_dirty, timestamp};
             fifo_queue.push(file_id);
         }
@@ -193,12 +304,17 @@ public:
     }
 
     std::string cacheableGetRequest(const std::string& store_name, const std::string& file_id, 
-                                        const std::unique_ptr<ProcessingService::Stub>& stub) {
+                                        const std::unique_ptr<ProcessingService::Stub>& stub,
+                                        uint64_t offset = 0, uint64_t length = 0) {
         loadAllCachesFromFile();
         std::string accumulated_content = "";
         std::cout << "File id: " << file_id << std::endl;
 
-        if (isInCache(file_id)) {
+        // A range can be served from the whole file or from a larger range in the cache
+        uint64_t skip = 0;
+        std::string cache_key = findCachedRange(file_id, offset, length, skip);
+
+        if (!cache_key.empty()) {
             // Tell server that client get file from cache
             cacheResponse cache_response;
             grpc::ClientContext cache_context;
@@ -208,15 +324,15 @@ public:
             std::cout << "Cache response: " << cache_response.message() << std::endl;
             if (!cache_response.success()) {
                 std::cerr << "Cache not latest fall back to send request to server: " << std::endl;
-                accumulated_content = getFileFromServer(store_name, file_id, stub.get());
+                accumulated_content = getFileFromServer(store_name, file_id, stub.get(), offset, length);
             } else {
                 std::cout << "Client Get from cache: " << std::endl;
-                std::string content = getContentFromCache(file_id);
+                std::string content = getRangeFromCache(cache_key, skip, length);
                 return content;
             }
         } else {
             // Get file from server
-            accumulated_content = getFileFromServer(store_name, file_id, stub.get());
+            accumulated_content = getFileFromServer(store_name, file_id, stub.get(), offset, length);
         }
         return accumulated_content;
     }
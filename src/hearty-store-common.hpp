@@ -5,6 +5,8 @@
 #include <iostream>
 #include <string>
 
+const size_t PUT_CHUNK_SIZE = 256 * 1024;   // Bytes per streamed Put message
+
 inline std::unique_ptr<ProcessingService::Stub> create_stub() {
     auto channel = grpc::CreateChannel("localhost:2546", grpc::InsecureChannelCredentials());
     return ProcessingService::NewStub(channel);
@@ -2,15 +2,19 @@
 #include "hearty-store-cache.hpp"
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cout << "Usage: " << argv[0] << " <store_name> <file_identifier>" << std::endl;
+    if (argc != 3 && argc != 5) {
+        std::cout << "Usage: " << argv[0] << " <store_name> <file_identifier> [<offset> <length>]" << std::endl;
         return 1;
     }
 
+    // Read only part of the file when a range is given, a length of 0 reads to the end
+    uint64_t offset = argc == 5 ? std::stoull(argv[3]) : 0;
+    uint64_t length = argc == 5 ? std::stoull(argv[4]) : 0;
+
     auto stub = create_stub();
     
     ClientCache cache;
-    std::string content = cache.cacheableGetRequest(argv[1], argv[2], stub);
+    std::string content = cache.cacheableGetRequest(argv[1], argv[2], stub, offset, length);
     if (content.empty()) {
         std::cout << "Error: Content is empty" << std::endl;
         return 1;
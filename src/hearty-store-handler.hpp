@@ -0,0 +1,571 @@
+/**
+ * @file hearty-store-handler.hpp
+ * @author Nathadon Samairat
+ * @brief Request handling shared by the synchronous and asynchronous servers.
+ *        Each handler takes the per-store lock, calls into the server
+ *        libraries and fills in the response message.
+ * @version 0.1
+ * @date 2024-12-06
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#pragma once
+#include <charconv>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+#include <proto/hearty-store.grpc.pb.h>
+#include <proto/hearty-store.pb.h>
+#include "../include/hearty-store-server.hpp"
+#include "../include/hearty-store-lock-manager.hpp"
+
+// Put carries a whole object in one message, lift gRPC's 4 MB default
+const int MAX_MESSAGE_SIZE = std::numeric_limits<int>::max();
+
+/**
+ * @brief An object served straight from the mapped data file. The store is
+ *        only read locked while the object is looked up; the lease pins the
+ *        object's space, so Puts go on while the mapped bytes are on their
+ *        way to the client and only its reuse waits for the lease to drop.
+ */
+struct MappedGet {
+    MappedObject object;
+};
+
+/**
+ * @brief A Put being received in pieces. Its store is locked exclusively
+ *        only to allocate the object at the first piece and to commit or
+ *        drop it at the end; the pieces in between are written unlocked.
+ */
+struct PutStreamState {
+    std::string store_name;
+    int store_id = -1;
+    std::shared_ptr<StreamedPut> put;
+    std::string error;      // Set once the stream failed, later pieces are dropped
+    grpc::StatusCode code = grpc::StatusCode::OK;   // Status of a stream that was rejected
+};
+
+class RequestHandler {
+private:
+    // Per-store reader/writer locks, requests queue up instead of being rejected
+    StoreLockManager store_locks;
+    // Guards the cache ownership table below
+    std::mutex ownership_lock;
+    // Varaible stores files id assiociated with client ip
+    // file_id -> client_ip
+    std::unordered_map<std::string, std::string> file_id_to_client_ip;
+    // Reserve the disk space of new stores at Init instead of creating them sparse
+    bool preallocate_stores;
+
+    static std::string busyMessage(const std::string& store_name) {
+        return "Timed out waiting for store " + store_name + ".";
+    }
+
+    // Helper function to parse a store name into its id, false if it is not one
+    static bool parseStoreId(const std::string& store_name, int& store_id) {
+        const char* end = store_name.data() + store_name.size();
+        auto [last, error] = std::from_chars(store_name.data(), end, store_id);
+        return !store_name.empty() && error == std::errc() && last == end && store_id >= 0;
+    }
+
+    static grpc::Status invalidStoreName(const std::string& store_name) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Invalid store name '" + store_name + "'.");
+    }
+
+public:
+    // Receives each chunk of a streamed Get response
+    using ChunkWriter = std::function<void(const ::getResponse&)>;
+
+    explicit RequestHandler(bool preallocate_stores = false)
+        : preallocate_stores(preallocate_stores) {}
+
+    grpc::Status Init(const ::initRequest& request, ::initResponse* response) {
+        std::cout << "InitRequest called with store_name: " << request.store_name() << std::endl;
+        
+        // Wait for exclusive access to the store being created
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            return invalidStoreName(request.store_name());
+        }
+        StoreLockGuard guard(store_locks, store_id, LockMode::EXCLUSIVE);
+        if (!guard.owns_lock()) {
+            response->set_success(false);
+            response->set_message(busyMessage(request.store_name()));
+            return grpc::Status::OK;
+        }
+        
+        StoreEngine engine;
+        if (!utils::parseEngine(request.engine(), engine)) {
+            response->set_success(false);
+            response->set_message("Unknown storage engine " + request.engine() + ".");
+            return grpc::Status::OK;
+        }
+
+        // Throw to the init function
+        if (!initialize(store_id, preallocate_stores, engine)) {
+            response->set_success(false);
+            response->set_message("Can not create a store instance.");
+            return grpc::Status::OK;
+        }
+
+        // Success status
+        response->set_success(true);
+        response->set_message("Success the store " + request.store_name() + " was created");
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Put(const ::putRequest& request, ::putResponse* response) {
+        std::cout << "Put Request called with store_name: " << request.store_name() << std::endl;
+        std::cout << "Put called with " << request.file_content().size() << " bytes" << std::endl;
+
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            return invalidStoreName(request.store_name());
+        }
+        try {
+            std::string object_id;
+            {
+                // Wait for exclusive access to the store
+                StoreLockGuard guard(store_locks, store_id, LockMode::EXCLUSIVE);
+                if (!guard.owns_lock()) {
+                    response->set_success(false);
+                    response->set_file_id("");
+                    response->set_message(busyMessage(request.store_name()));
+                    return grpc::Status::OK;
+                }
+
+                object_id = put(store_id, request.file_path(), request.file_content());
+            }
+
+            // Acknowledge only once the commit is on disk. The store is already
+            // unlocked, so the commits of concurrent Puts share one sync.
+            if (!object_id.empty() && !syncLog(store_id)) {
+                object_id.clear();
+            }
+            
+            if (object_id.empty()) {
+                response->set_success(false);
+                response->set_file_id("");
+                response->set_message("Failed to store file in store " + request.store_name());
+            } else {
+                response->set_success(true);
+                response->set_file_id(object_id);
+                response->set_message("Success file stored in store " + request.store_name());
+            }
+        }
+        catch (const std::exception& e) {
+            response->set_success(false);
+            response->set_message(std::string("Error processing request: ") + e.what());
+        }
+        return grpc::Status::OK;
+    }
+
+    // Helper function to drop a streamed Put that will not commit. Its space
+    // is given back under the store lock, waited for however long it takes.
+    void abortStream(PutStreamState& state) {
+        if (!state.put) {
+            return;
+        }
+        while (!store_locks.lock(state.store_id, LockMode::EXCLUSIVE)) {
+        }
+        putAbort(*state.put);
+        store_locks.unlock(state.store_id, LockMode::EXCLUSIVE);
+        state.put.reset();
+    }
+
+    /**
+     * @brief Handles the next piece of a streamed Put: the first piece locks
+     *        the store just long enough to allocate the object, every piece
+     *        is written to disk before the next one is handled.
+     *
+     * @param state - State of the stream, empty before the first piece.
+     * @param piece - The piece received.
+     */
+    void PutStreamPiece(PutStreamState& state, const ::putStreamRequest& piece) {
+        if (!state.error.empty()) {
+            return;
+        }
+
+        try {
+            if (!state.put) {
+                state.store_name = piece.store_name();
+                std::cout << "PutStream called with store_name: " << piece.store_name()
+                          << " for " << piece.file_size() << " bytes" << std::endl;
+
+                int store_id;
+                if (!parseStoreId(piece.store_name(), store_id)) {
+                    state.error = invalidStoreName(piece.store_name()).error_message();
+                    state.code = grpc::StatusCode::INVALID_ARGUMENT;
+                    return;
+                }
+                state.store_id = store_id;
+
+                // Wait for exclusive access to the store while the object is allocated
+                StoreLockGuard guard(store_locks, store_id, LockMode::EXCLUSIVE);
+                if (!guard.owns_lock()) {
+                    state.error = busyMessage(piece.store_name());
+                    return;
+                }
+                state.put = putBegin(store_id, piece.file_path(), piece.file_size());
+                if (!state.put) {
+                    state.error = "Failed to store file in store " + piece.store_name();
+                    return;
+                }
+            }
+
+            // The allocated space is the put's own, written without the lock
+            const std::string& content = piece.file_content();
+            if (!putAppend(*state.put, content.data(), content.size())) {
+                state.error = "Failed to store file in store " + state.store_name;
+            }
+        }
+        catch (const std::exception& e) {
+            state.error = std::string("Error processing request: ") + e.what();
+        }
+    }
+
+    /**
+     * @brief Commits a streamed Put once the client has sent every piece.
+     *
+     * @param state     - State of the stream.
+     * @param response  - Filled in with the ID of the new object or the failure.
+     * @return The status of the call, not OK if the stream was rejected.
+     */
+    grpc::Status PutStreamFinish(PutStreamState& state, ::putResponse* response) {
+        if (state.code != grpc::StatusCode::OK) {
+            return grpc::Status(state.code, state.error);
+        }
+
+        std::string object_id;
+        if (state.error.empty() && state.put) {
+            try {
+                StoreLockGuard guard(store_locks, state.store_id, LockMode::EXCLUSIVE);
+                if (!guard.owns_lock()) {
+                    state.error = busyMessage(state.store_name);
+                } else {
+                    object_id = putCommit(*state.put);
+                    if (object_id.empty()) {
+                        state.error = "Failed to store file in store " + state.store_name;
+                    } else {
+                        state.put.reset();
+                    }
+                }
+            }
+            catch (const std::exception& e) {
+                state.error = std::string("Error processing request: ") + e.what();
+            }
+        } else if (state.error.empty()) {
+            state.error = "Empty Put stream";
+        }
+
+        // A put that did not commit gives its space back
+        abortStream(state);
+
+        // Acknowledge only once the commit is on disk, sharing the sync with other Puts
+        if (!object_id.empty() && !syncLog(state.store_id)) {
+            object_id.clear();
+            state.error = "Failed to store file in store " + state.store_name;
+        }
+
+        if (object_id.empty()) {
+            response->set_success(false);
+            response->set_file_id("");
+            response->set_message(state.error);
+        } else {
+            response->set_success(true);
+            response->set_file_id(object_id);
+            response->set_message("Success file stored in store " + state.store_name);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Get(const ::getRequest& request, const ChunkWriter& write) {
+        std::cout << "Get called for store_name: " << request.store_name()
+                  << " and file_identifier: " << request.file_identifier() << std::endl;
+
+        // Readers of the same store share the lock
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            return invalidStoreName(request.store_name());
+        }
+        StoreLockGuard guard(store_locks, store_id, LockMode::SHARED);
+        if (!guard.owns_lock()) {
+            ::getResponse response;
+            response.set_success(false);
+            response.set_message(busyMessage(request.store_name()));
+            write(response);
+            return grpc::Status::OK;
+        }
+
+        // Stream the content in chunks straight off disk. The response is
+        // reused so a stream holds one chunk however large the object is,
+        // and write blocks until flow control lets the chunk out.
+        std::string file_identifier = request.file_identifier();
+        size_t chunks = 0;
+        ::getResponse response;
+        response.set_success(true);
+        bool success = getChunks(store_id, file_identifier, request.offset(), request.length(),
+                                 [&](const char* data, size_t size) {
+            response.set_file_content(data, size);
+            write(response);
+            chunks++;
+        });
+
+        if (!success) {
+            response.Clear();
+            response.set_success(false);
+            response.set_message("Failed to retrieve file with identifier " + file_identifier);
+            write(response);
+        } else if (chunks == 0) {
+            // An empty object or range still gets its one response
+            write(response);
+        }
+        return grpc::Status::OK;
+    }
+
+    /**
+     * @brief Get without reading the object: hands out a lease on its views
+     *        into the mapped data file instead of streaming copies of it.
+     *
+     * @param request   - The Get request.
+     * @param failure   - Filled in with the response to send if there is no lease.
+     * @param status    - Set to the status to end the call with if the request is invalid.
+     * @return The lease, or null on failure.
+     */
+    std::shared_ptr<MappedGet> GetMapped(const ::getRequest& request, ::getResponse* failure,
+                                         grpc::Status* status) {
+        std::cout << "Get called for store_name: " << request.store_name()
+                  << " and file_identifier: " << request.file_identifier() << std::endl;
+
+        // Readers of the same store share the lock while the object is looked up
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            *status = invalidStoreName(request.store_name());
+            return nullptr;
+        }
+        StoreLockGuard guard(store_locks, store_id, LockMode::SHARED);
+        if (!guard.owns_lock()) {
+            failure->set_success(false);
+            failure->set_message(busyMessage(request.store_name()));
+            return nullptr;
+        }
+
+        // An empty object or range is a lease without views
+        auto lease = std::make_shared<MappedGet>();
+        std::string file_identifier = request.file_identifier();
+        if (!getMapped(store_id, file_identifier, request.offset(), request.length(), lease->object)) {
+            failure->set_success(false);
+            failure->set_message("Failed to retrieve file with identifier " + file_identifier);
+            return nullptr;
+        }
+        return lease;
+    }
+
+    grpc::Status BatchPut(const ::batchPutRequest& request, ::batchPutResponse* response) {
+        std::cout << "BatchPut called with store_name: " << request.store_name()
+                  << " for " << request.objects_size() << " objects" << std::endl;
+
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            return invalidStoreName(request.store_name());
+        }
+        try {
+            std::vector<std::pair<std::string, std::string>> objects;
+            objects.reserve(request.objects_size());
+            for (const ::batchPutObject& object : request.objects()) {
+                objects.emplace_back(object.file_path(), object.file_content());
+            }
+
+            std::vector<std::string> object_ids;
+            {
+                // The whole batch is one transaction under the exclusive lock
+                StoreLockGuard guard(store_locks, store_id, LockMode::EXCLUSIVE);
+                if (!guard.owns_lock()) {
+                    response->set_success(false);
+                    response->set_message(busyMessage(request.store_name()));
+                    return grpc::Status::OK;
+                }
+
+                object_ids = putBatch(store_id, objects);
+            }
+
+            // Acknowledge only once the commit is on disk, sharing the sync with other Puts
+            if (!object_ids.empty() && !syncLog(store_id)) {
+                object_ids.clear();
+            }
+            if (object_ids.empty() && !objects.empty()) {
+                response->set_success(false);
+                response->set_message("Failed to store files in store " + request.store_name());
+                return grpc::Status::OK;
+            }
+            for (const std::string& object_id : object_ids) {
+                response->add_file_ids(object_id);
+            }
+            response->set_success(true);
+            response->set_message("Success " + std::to_string(object_ids.size()) +
+                                  " files stored in store " + request.store_name());
+        }
+        catch (const std::exception& e) {
+            response->set_success(false);
+            response->set_message(std::string("Error processing request: ") + e.what());
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status BatchGet(const ::batchGetRequest& request, ::batchGetResponse* response) {
+        std::cout << "BatchGet called with store_name: " << request.store_name()
+                  << " for " << request.file_identifiers_size() << " objects" << std::endl;
+
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            return invalidStoreName(request.store_name());
+        }
+        try {
+            // Readers of the same store share the lock
+            StoreLockGuard guard(store_locks, store_id, LockMode::SHARED);
+            if (!guard.owns_lock()) {
+                response->set_success(false);
+                response->set_message(busyMessage(request.store_name()));
+                return grpc::Status::OK;
+            }
+
+            std::vector<std::string> object_ids(request.file_identifiers().begin(),
+                                                request.file_identifiers().end());
+            std::vector<std::string> contents;
+            std::vector<bool> found;
+            if (!getBatch(store_id, object_ids, contents, found)) {
+                response->set_success(false);
+                response->set_message("Failed to read files from store " + request.store_name());
+                return grpc::Status::OK;
+            }
+
+            // Each object reports on its own, a missing one does not fail the rest
+            for (size_t i = 0; i < contents.size(); i++) {
+                ::batchGetObject* object = response->add_objects();
+                object->set_success(found[i]);
+                object->set_file_content(std::move(contents[i]));
+            }
+            response->set_success(true);
+        }
+        catch (const std::exception& e) {
+            response->set_success(false);
+            response->set_message(std::string("Error processing request: ") + e.what());
+        }
+        return grpc::Status::OK;
+    }
+
+    void List(const ::listRequest& request, ::listResponse* response) {
+        std::cout << "List called." << std::endl;
+        // Hold every store in shared mode while reading their metadata
+        StoreLockGuard guard(store_locks, utils::getStoreIds(), LockMode::SHARED);
+        if (!guard.owns_lock()) {
+            response->set_success(false);
+            response->set_message("Timed out waiting for the stores.");
+            return;
+        }
+        
+        // Throw to the list function
+        std::string status = list_stores();
+        response->set_success(true);
+        response->set_message(status);
+    }
+
+    grpc::Status Destroy(const ::destroyRequest& request, ::destroyResponse* response) {
+        std::cout << "Destroy called for store_name: " << request.store_name() << std::endl;
+        
+        // Wait until nobody else is using the store
+        int store_id;
+        if (!parseStoreId(request.store_name(), store_id)) {
+            return invalidStoreName(request.store_name());
+        }
+        StoreLockGuard guard(store_locks, store_id, LockMode::EXCLUSIVE);
+        if (!guard.owns_lock()) {
+            response->set_success(false);
+            response->set_message(busyMessage(request.store_name()));
+            return grpc::Status::OK;
+        }
+
+        // Destroy the store
+        if (!destroy_store(store_id)) {
+            response->set_success(false);
+            response->set_message("Failed to destroy store " + request.store_name());
+        } else {
+            response->set_success(true);
+            response->set_message("Destroyed store " + request.store_name());
+        }
+        return grpc::Status::OK;
+    }
+
+    void Cache(const std::string& client_ip, const ::cacheRequest& request, 
+               ::cacheResponse* response) {
+        std::cout << "Cache called for file_id: " << request.file_id() << std::endl;
+        std::string file_id = request.file_id();
+        std::cout << "Client ip: " << client_ip << std::endl;
+        
+        std::unique_lock<std::mutex> lock(ownership_lock);
+
+        // If file_id is empty, assign it to the client
+        if (file_id.empty()) {
+            file_id = client_ip;
+            file_id_to_client_ip[file_id] = client_ip;
+            response->set_success(true);
+            response->set_message("File ID assigned: " + file_id);
+        } else {
+            // Check if file is owned by a different client
+            auto it = file_id_to_client_ip.find(file_id);
+            if (it != file_id_to_client_ip.end() && it->second != client_ip) {
+                // Send eviction request to the current owner
+                std::string owner_ip = it->second;
+                evictRequest evict_req;
+                evictResponse evict_resp;
+                grpc::ClientContext evict_context;
+                
+                std::shared_ptr<grpc::Channel> channel = 
+                    grpc::CreateChannel(owner_ip, grpc::InsecureChannelCredentials());
+                std::unique_ptr<ProcessingService::Stub> stub = 
+                    ProcessingService::NewStub(channel);
+                
+                // The owner may write back through Put, so do not hold the table meanwhile
+                evict_req.set_file_id(file_id);
+                lock.unlock();
+                grpc::Status status = stub->Evict(&evict_context, evict_req, &evict_resp);
+                lock.lock();
+                
+                if (status.ok() && evict_resp.success()) {
+                    // Update ownership
+                    file_id_to_client_ip[file_id] = client_ip;
+                    response->set_success(true);
+                    response->set_message("Cache ownership transferred");
+                } else {
+                    response->set_success(false);
+                    response->set_message("Failed to evict from current owner");
+                }
+            } else {
+                // File is either unowned or owned by the requesting client
+                file_id_to_client_ip[file_id] = client_ip;
+                response->set_success(true);
+                response->set_message("Cache ownership confirmed");
+            }
+        }
+    }
+
+    void Evict(const ::evictRequest& request, ::evictResponse* response) {
+        std::string file_id = request.file_id();
+        
+        // Remove the file_id from tracking
+        {
+            std::lock_guard<std::mutex> lock(ownership_lock);
+            file_id_to_client_ip.erase(file_id);
+        }
+        
+        response->set_success(true);
+        response->set_message("File evicted successfully");
+    }
+};
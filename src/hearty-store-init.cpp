@@ -1,8 +1,8 @@
 #include "hearty-store-common.hpp"
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cout << "Usage: " << argv[0] << " <store_name>" << std::endl;
+    if (argc != 2 && argc != 3) {
+        std::cout << "Usage: " << argv[0] << " <store_name> [block|log]" << std::endl;
         return 1;
     }
 
@@ -13,6 +13,9 @@ int main(int argc, char* argv[]) {
     grpc::ClientContext context;
     
     request.set_store_name(argv[1]);
+    if (argc == 3) {
+        request.set_engine(argv[2]);
+    }
     grpc::Status status = stub->Init(&context, request, &response);
     
     std::cout << "Init request sent" << std::endl;
@@ -1,268 +1,218 @@
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <mutex>
-#include <unistd.h> // for delay checking mutex lock
-#include <filesystem>
+#include <string>
+#include <thread>
 #include <grpcpp/grpcpp.h>
 #include <proto/hearty-store.grpc.pb.h>
 #include <proto/hearty-store.pb.h>
 #include <grpcpp/server_builder.h>
-#include "../include/hearty-store-server.hpp"
-
-namespace fs = std::filesystem;
-
+#include "hearty-store-handler.hpp"
+#include "hearty-store-async-server.hpp"
+#include "../include/hearty-store-uring.hpp"
+#include "../include/hearty-store-wal.hpp"
+#include "../include/hearty-store-registry.hpp"
+#include "../include/hearty-store-thread-pool.hpp"
+#include "../include/hearty-store-buffer-pool.hpp"
+
+const size_t DEFAULT_IO_THREADS = 16;   // Disk workers of the async server
+const size_t DEFAULT_CHECKPOINT_INTERVAL_MS = 1000;
+
+// Synchronous front end, every call occupies a gRPC thread until it is done
 class ProcessingImpl : public ProcessingService::Service {
 private:
-    std::mutex global_lock;
-    // Varaible stores files id assiociated with client ip
-    // file_id -> client_ip
-    std::unordered_map<std::string, std::string> file_id_to_client_ip;
-
-    bool try_lock_server() {
-        return global_lock.try_lock();
-    }
-
-    void unlock_server() {
-        global_lock.unlock();
-    }
+    RequestHandler& handler;
 
 public:
+    explicit ProcessingImpl(RequestHandler& handler) : handler(handler) {}
+
     ::grpc::Status Init(::grpc::ServerContext* context, 
                                const ::initRequest* request, 
                                ::initResponse* response) override {
-        std::cout << "InitRequest called with store_name: " << request->store_name() << std::endl;
-        
-        // Busy due to the mutex lock
-        if (!try_lock_server()) {
-            response->set_success(false);
-            response->set_message("Server is handling another request.");
-            return grpc::Status::OK;
-        }
-        
-        // Throw to the init function
-        int store_id = std::stoi(request->store_name());
-        if (!initialize(store_id)) {
-            unlock_server();
-            response->set_success(false);
-            response->set_message("Can not create a store instance.");
-            return grpc::Status::OK;
-        }
-
-        // Success status
-        response->set_success(true);
-        response->set_message("Success the store " + request->store_name() + " was created");
-
-        unlock_server();
-        return grpc::Status::OK;
+        return handler.Init(*request, response);
     }
 
     ::grpc::Status Put(::grpc::ServerContext* context, 
                        const ::putRequest* request, 
                        ::putResponse* response) override {
-        std::cout << "Put Request called with store_name: " << request->store_name() << std::endl;
-        std::cout << "Put called with content: " << request->file_content() << std::endl;
-
-        // Busy due to the mutex lock
-        if (!try_lock_server()) {
-            response->set_success(false);
-            response->set_file_id("");
-            response->set_message("Server is handling another request.");
-            return grpc::Status::OK;
-        }
+        return handler.Put(*request, response);
+    }
 
-        try {
-            int store_id = std::stoi(request->store_name());
-            std::string object_id = put(store_id, request->file_path(), request->file_content());
-            
-            if (object_id.empty()) {
-                response->set_success(false);
-                response->set_file_id("");
-                response->set_message("Failed to store file in store " + request->store_name());
-            } else {
-                response->set_success(true);
-                response->set_file_id(object_id);
-                response->set_message("Success file stored in store " + request->store_name());
+    ::grpc::Status PutStream(::grpc::ServerContext* context,
+                             ::grpc::ServerReader<::putStreamRequest>* reader,
+                             ::putResponse* response) override {
+        // A piece is written on its own thread while the next one is received
+        // into the other buffer, so at most two pieces are held at a time
+        PutStreamState state;
+        ::putStreamRequest pieces[2];
+        std::future<void> written;
+        for (int next = 0; reader->Read(&pieces[next]); next ^= 1) {
+            if (written.valid()) {
+                written.get();
             }
+            const ::putStreamRequest& piece = pieces[next];
+            written = std::async(std::launch::async, [this, &state, &piece] {
+                handler.PutStreamPiece(state, piece);
+            });
         }
-        catch (const std::exception& e) {
-            response->set_success(false);
-            response->set_message(std::string("Error processing request: ") + e.what());
+        if (written.valid()) {
+            written.get();
         }
+        return handler.PutStreamFinish(state, response);
+    }
 
-        unlock_server();
-        return grpc::Status::OK;
+    ::grpc::Status BatchPut(::grpc::ServerContext* context,
+                            const ::batchPutRequest* request,
+                            ::batchPutResponse* response) override {
+        return handler.BatchPut(*request, response);
+    }
+
+    ::grpc::Status BatchGet(::grpc::ServerContext* context,
+                            const ::batchGetRequest* request,
+                            ::batchGetResponse* response) override {
+        return handler.BatchGet(*request, response);
     }
 
     ::grpc::Status Get(::grpc::ServerContext* context, 
                        const ::getRequest* request, 
                        ::grpc::ServerWriter<::getResponse>* writer) override {
-        std::cout << "Get called for store_name: " << request->store_name()
-                  << " and file_identifier: " << request->file_identifier() << std::endl;
-
-        
-        if (!try_lock_server()) {
-            ::getResponse response;
-            response.set_success(false);
-            response.set_message("Server is handling another request.");
-            writer->Write(response);
-            return grpc::Status::OK;
-        }
-
-        
-        int store_id = std::stoi(request->store_name());
-        std::string file_identifier = request->file_identifier();
-        std::string content = get(store_id, file_identifier);
-
-        if (content.empty()) {
-            ::getResponse response;
-            response.set_success(false);
-            response.set_message("Failed to retrieve file with identifier " + file_identifier);
-            writer->Write(response);
-        } else {
-            // Stream the content in chunks
-            ::getResponse response;
-            for (size_t i = 0; i < content.size(); i += BLOCK_SIZE) {
-                response.set_success(true);
-                response.set_file_content(content.substr(i, BLOCK_SIZE));
-                writer->Write(response);
-            }
-        }
-    
-        unlock_server();
-        return grpc::Status::OK;
+        return handler.Get(*request, [writer](const ::getResponse& chunk) {
+            writer->Write(chunk);
+        });
     }
 
     ::grpc::Status List(::grpc::ServerContext* context, 
                         const ::listRequest* request, 
                         ::listResponse* response) override {
-        std::cout << "List called." << std::endl;
-         // Busy due to the mutex lock
-        if (!try_lock_server()) {
-            response->set_success(false);
-            response->set_message("Server is handling another request.");
-            return grpc::Status::OK;
-        }
-        
-        // Throw to the list function
-        std::string status = list_stores();
-        response->set_success(true);
-        response->set_message(status);
-
-        unlock_server();
+        handler.List(*request, response);
         return grpc::Status::OK;
     }
 
     ::grpc::Status Destroy(::grpc::ServerContext* context, 
                            const ::destroyRequest* request, 
                            ::destroyResponse* response) override {
-        std::cout << "Destroy called for store_name: " << request->store_name() << std::endl;
-        
-        // Busy due to the mutex lock
-        if (!try_lock_server()) {
-            response->set_success(false);
-            response->set_message("Server is handling another request.");
-            return grpc::Status::OK;
-        }
-
-        // Destroy the store
-        int store_id = std::stoi(request->store_name());
-        if (!destroy_store(store_id)) {
-            response->set_success(false);
-            response->set_message("Failed to destroy store " + request->store_name());
-        } else {
-            response->set_success(true);
-            response->set_message("Destroyed store " + request->store_name());
-        }
-        
-        unlock_server();
-        return grpc::Status::OK;
+        return handler.Destroy(*request, response);
     }
 
     ::grpc::Status Cache(::grpc::ServerContext* context, 
                           const ::cacheRequest* request, 
                           ::cacheResponse* response) override {
-        std::cout << "Cache called for file_id: " << request->file_id() << std::endl;
-        std::string client_ip = context->peer();
-        std::string file_id = request->file_id();
-        std::cout << "Client ip: " << client_ip << std::endl;
-        
-        if (!try_lock_server()) {
-            response->set_success(false);
-            response->set_message("Server is handling another request.");
-            return grpc::Status::OK;
-        }
-
-        // If file_id is empty, assign it to the client
-        if (file_id.empty()) {
-            file_id = client_ip;
-            file_id_to_client_ip[file_id] = client_ip;
-            response->set_success(true);
-            response->set_message("File ID assigned: " + file_id);
-        } else {
-            // Check if file is owned by a different client
-            auto it = file_id_to_client_ip.find(file_id);
-            if (it != file_id_to_client_ip.end() && it->second != client_ip) {
-                // Send eviction request to the current owner
-                evictRequest evict_req;
-                evictResponse evict_resp;
-                grpc::ClientContext evict_context;
-                
-                std::shared_ptr<grpc::Channel> channel = 
-                    grpc::CreateChannel(it->second, grpc::InsecureChannelCredentials());
-                std::unique_ptr<ProcessingService::Stub> stub = 
-                    ProcessingService::NewStub(channel);
-                
-                evict_req.set_file_id(file_id);
-                grpc::Status status = stub->Evict(&evict_context, evict_req, &evict_resp);
-                
-                if (status.ok() && evict_resp.success()) {
-                    // Update ownership
-                    file_id_to_client_ip[file_id] = client_ip;
-                    response->set_success(true);
-                    response->set_message("Cache ownership transferred");
-                } else {
-                    response->set_success(false);
-                    response->set_message("Failed to evict from current owner");
-                }
-            } else {
-                // File is either unowned or owned by the requesting client
-                file_id_to_client_ip[file_id] = client_ip;
-                response->set_success(true);
-                response->set_message("Cache ownership confirmed");
-            }
-        }
-
-        unlock_server();
+        handler.Cache(context->peer(), *request, response);
         return grpc::Status::OK;
     }
 
     ::grpc::Status Evict(::grpc::ServerContext* context,
                         const ::evictRequest* request,
                         ::evictResponse* response) override {
-        std::string file_id = request->file_id();
-        
-        if (!try_lock_server()) {
-            response->set_success(false);
-            response->set_message("Server is handling another request.");
-            return grpc::Status::OK;
-        }
-
-        // Remove the file_id from tracking
-        file_id_to_client_ip.erase(file_id);
-        
-        response->set_success(true);
-        response->set_message("File evicted successfully");
-
-        unlock_server();
+        handler.Evict(*request, response);
         return grpc::Status::OK;
     }
 };
 
-int main() {
+// Helper function to load and replay every store on disk before serving
+static void recoverStores(size_t num_threads) {
+    std::vector<int> store_ids = utils::getStoreIds();
+    if (store_ids.empty()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::mutex output_lock;
+    std::atomic<size_t> failed{0};
+    {
+        // Stores are independent, each is replayed by one worker
+        ThreadPool pool(std::min(num_threads, store_ids.size()));
+        for (int store_id : store_ids) {
+            pool.submit([store_id, &output_lock, &failed] {
+                auto store_start = std::chrono::steady_clock::now();
+                bool recovered = StoreRegistry::instance().acquire(store_id) != nullptr;
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - store_start);
+
+                std::lock_guard<std::mutex> lock(output_lock);
+                if (!recovered) {
+                    failed++;
+                    std::cerr << "Failed to recover store " << store_id << std::endl;
+                    return;
+                }
+                std::cout << "Recovered store " << store_id << " in "
+                          << elapsed.count() / 1000.0 << " ms" << std::endl;
+            });
+        }
+    }   // Waits for every store
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    std::cout << "Recovered " << store_ids.size() - failed << "/" << store_ids.size() << " stores in "
+              << elapsed.count() << " ms with " << std::min(num_threads, store_ids.size())
+              << " threads" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
     std::string service_ports = "0.0.0.0:2546";
-    ProcessingImpl service;
+    bool async_mode = false;
+    bool preallocate = false;
+    bool io_uring = false;
+    size_t cq_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t io_threads = DEFAULT_IO_THREADS;
+    size_t checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL_MS;
+    size_t recovery_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--async") {
+            async_mode = true;
+        } else if (arg == "--preallocate") {
+            preallocate = true;
+        } else if (arg == "--io-uring") {
+            io_uring = true;
+        } else if (arg == "--cq-threads" && i + 1 < argc) {
+            cq_threads = std::stoul(argv[++i]);
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            io_threads = std::stoul(argv[++i]);
+        } else if (arg == "--commit-delay" && i + 1 < argc) {
+            // Longest a Put waits for others to share its log sync
+            GroupCommitLog::setMaxDelay(std::chrono::microseconds(std::stoul(argv[++i])));
+        } else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+            checkpoint_interval = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--recovery-threads" && i + 1 < argc) {
+            recovery_threads = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--buffer-pool" && i + 1 < argc) {
+            // Memory for popular object blocks in MB, 0 reads every Get from disk
+            BufferPool::instance().setCapacity(std::stoul(argv[++i]) * 1024 * 1024);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--async] [--preallocate] [--io-uring] [--cq-threads <n>] [--io-threads <n>]"
+                      << " [--commit-delay <us>] [--checkpoint-interval <ms>] [--recovery-threads <n>]"
+                      << " [--buffer-pool <MB>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    // Store files opened from here on do their I/O through io_uring
+    if (io_uring && !UringEngine::start()) {
+        std::cerr << "io_uring is not available, using pread/pwrite" << std::endl;
+    }
+
+    // Recover every store before the port opens, requests never touch the log again
+    recoverStores(recovery_threads);
+    StoreRegistry::instance().startCheckpoints(std::chrono::milliseconds(checkpoint_interval));
+
+    RequestHandler handler(preallocate);
+    if (async_mode) {
+        AsyncServer server(handler, cq_threads, io_threads);
+        server.run(service_ports);
+        return 0;
+    }
+
+    ProcessingImpl service(handler);
 
     grpc::ServerBuilder builder;
     builder.AddListeningPort(service_ports, grpc::InsecureServerCredentials());
+    builder.SetMaxReceiveMessageSize(MAX_MESSAGE_SIZE);
     builder.RegisterService(&service);
 
     std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
@@ -271,4 +221,4 @@ int main() {
     server->Wait();
 
     return 0;
-}
\ No newline at end of file
+}